@@ -0,0 +1,263 @@
+#include "perfhash.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace perfhash;
+
+/**
+ * Benchmark comparing perfhash containers against the standard ones.
+ *
+ * For each key count given on the command line (default 1K to 1M), reports
+ * build time, memory per key, and lookup cost for hits and misses, for
+ * integer and string keys. Lookups are timed two ways: "hit" and "miss" issue
+ * independent lookups, so they measure throughput, while "latency" chains
+ * every lookup on the result of the previous one, so memory stalls can't
+ * overlap.
+ */
+
+using clock_type = std::chrono::steady_clock;
+using value_type = uint64_t;
+
+static constexpr size_t query_count = 1 << 20;
+
+/**
+ * @brief Bytes currently held through counting_allocator.
+ */
+static size_t allocated = 0;
+
+/**
+ * @brief Consumes lookup results, so the compiler can't drop the lookups.
+ */
+static volatile value_type sink_out;
+
+/**
+ * @brief Allocator counting live bytes, so the standard containers can report
+ *  their memory usage like the perfhash ones do.
+ */
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+
+    counting_allocator() = default;
+
+    template <typename U>
+    counting_allocator(const counting_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        allocated += n * sizeof(T) + allocation_overhead;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        allocated -= n * sizeof(T) + allocation_overhead;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const counting_allocator<U>&) const { return true; }
+
+    template <typename U>
+    bool operator!=(const counting_allocator<U>&) const { return false; }
+};
+
+template <typename Key>
+using elements_t = std::vector<std::pair<Key, value_type>>;
+
+template <typename Key, template <typename, typename> typename Engine>
+struct perfhash_adapter {
+    using map_type = perfect_hash_map<Key, value_type, ru_hash_family<Key>,
+        std::allocator<std::pair<Key, value_type>>, Engine>;
+
+    map_type map;
+
+    explicit perfhash_adapter(const elements_t<Key>& elements)
+        : map(elements.begin(), elements.end()) {}
+
+    size_t bytes() const { return map.memory_usage(); }
+
+    value_type hit(const Key& key) const { return map[key]; }
+
+    bool miss(const Key& key) const { return map.find(key) == nullptr; }
+};
+
+template <typename Key>
+struct blocked_adapter {
+    blocked_perfect_hash_map<Key, value_type> map;
+
+    explicit blocked_adapter(const elements_t<Key>& elements)
+        : map(elements.begin(), elements.end()) {}
+
+    size_t bytes() const { return map.memory_usage(); }
+
+    value_type hit(const Key& key) const { return map[key]; }
+
+    bool miss(const Key& key) const { return map.find(key) == nullptr; }
+};
+
+template <typename Key>
+struct unordered_map_adapter {
+    using map_type = std::unordered_map<Key, value_type, std::hash<Key>,
+        std::equal_to<Key>,
+        counting_allocator<std::pair<const Key, value_type>>>;
+
+    map_type map;
+    size_t m_bytes;
+
+    explicit unordered_map_adapter(const elements_t<Key>& elements) {
+        size_t before = allocated;
+        map = map_type(elements.begin(), elements.end());
+        m_bytes = sizeof(map) + allocated - before;
+    }
+
+    size_t bytes() const { return m_bytes; }
+
+    value_type hit(const Key& key) const { return map.find(key)->second; }
+
+    bool miss(const Key& key) const { return map.find(key) == map.end(); }
+};
+
+template <typename Key>
+struct sorted_vector_adapter {
+    std::vector<std::pair<Key, value_type>> elements;
+
+    explicit sorted_vector_adapter(const elements_t<Key>& e) : elements(e) {
+        std::sort(elements.begin(), elements.end());
+    }
+
+    size_t bytes() const {
+        return sizeof(elements) + perfhash::memory_usage(elements);
+    }
+
+    auto lower_bound(const Key& key) const {
+        return std::lower_bound(elements.begin(), elements.end(), key,
+            [](const auto& e, const Key& k) { return e.first < k; });
+    }
+
+    value_type hit(const Key& key) const { return lower_bound(key)->second; }
+
+    bool miss(const Key& key) const {
+        auto it = lower_bound(key);
+        return it == elements.end() || it->first != key;
+    }
+};
+
+static double seconds_since(clock_type::time_point start) {
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+/**
+ * @brief Builds a container and times lookups on it, printing one row.
+ */
+template <typename Adapter, typename Key>
+void run(const char* name, const char* key_name,
+         const elements_t<Key>& elements,
+         const std::vector<Key>& hits, const std::vector<Key>& misses) {
+    auto start = clock_type::now();
+    Adapter adapter(elements);
+    double build = seconds_since(start);
+
+    value_type sink = 0;
+
+    start = clock_type::now();
+    for (const Key& key : hits) sink += adapter.hit(key);
+    double hit = seconds_since(start);
+
+    start = clock_type::now();
+    for (const Key& key : misses) sink += adapter.miss(key);
+    double miss = seconds_since(start);
+
+    // Every value is zero, so adding it to the index doesn't change which key
+    // comes next, but the next lookup can't start before this one finishes.
+    start = clock_type::now();
+    size_t j = 0;
+    for (size_t i = 0; i < hits.size(); i++)
+        j = (i + 1 + adapter.hit(hits[j])) % hits.size();
+    double latency = seconds_since(start);
+    sink_out = sink + j;
+
+    std::printf("%-14s %-6s %10zu %10.2f %9.1f %8.1f %8.1f %8.1f\n",
+        name, key_name, elements.size(), build * 1e3,
+        double(adapter.bytes()) / elements.size(),
+        hit * 1e9 / hits.size(), miss * 1e9 / misses.size(),
+        latency * 1e9 / hits.size());
+}
+
+template <typename Key, typename Make>
+void run_all(const char* key_name, size_t n, const Make& make) {
+    splitmix64 rng;
+    rng.seed(n);
+
+    // Draw twice as many distinct keys as needed, so half can be misses.
+    std::vector<Key> keys;
+    keys.reserve(2 * n);
+    for (size_t i = 0; i < 2 * n; i++) keys.push_back(make(rng));
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    for (size_t i = keys.size() - 1; i > 0; i--)
+        std::swap(keys[i], keys[rng() % (i + 1)]);
+    if (keys.size() < 2 * n) {
+        std::fprintf(stderr, "not enough distinct keys for n = %zu\n", n);
+        return;
+    }
+
+    elements_t<Key> elements;
+    elements.reserve(n);
+    for (size_t i = 0; i < n; i++) elements.emplace_back(keys[i], 0);
+
+    std::vector<Key> hits, misses;
+    for (size_t i = 0; i < query_count; i++) {
+        hits.push_back(keys[rng() % n]);
+        misses.push_back(keys[n + rng() % n]);
+    }
+
+    run<perfhash_adapter<Key, fks_engine>>(
+        "perfhash/fks", key_name, elements, hits, misses);
+    if constexpr (std::is_integral_v<Key>) {
+        run<perfhash_adapter<Key, fused_fks_engine>>(
+            "perfhash/fused", key_name, elements, hits, misses);
+        run<blocked_adapter<Key>>(
+            "perfhash/block", key_name, elements, hits, misses);
+    }
+    run<perfhash_adapter<Key, chd_engine>>(
+        "perfhash/chd", key_name, elements, hits, misses);
+    run<unordered_map_adapter<Key>>(
+        "unordered_map", key_name, elements, hits, misses);
+    run<sorted_vector_adapter<Key>>(
+        "sorted_vector", key_name, elements, hits, misses);
+}
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+        sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = { 1000, 10000, 100000, 1000000 };
+
+    std::printf("%-14s %-6s %10s %10s %9s %8s %8s %8s\n",
+        "container", "key", "keys", "build ms", "bytes/key",
+        "hit ns", "miss ns", "lat ns");
+
+    for (size_t n : sizes) {
+        run_all<uint64_t>("u64", n, [](splitmix64& rng) { return rng(); });
+
+        // Short enough to stay in the small string buffer, so memory figures
+        // only count the containers themselves.
+        run_all<std::string>("string", n, [](splitmix64& rng) {
+            std::string key(12, ' ');
+            uint64_t bits = rng();
+            for (char& c : key) {
+                c = 'a' + bits % 26;
+                bits /= 26;
+            }
+            return key;
+        });
+    }
+
+    return 0;
+}
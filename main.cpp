@@ -1,11 +1,71 @@
 #include "perfhash.hpp"
 
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <list>
 #include <string>
 
 #include <iostream>
 
-using namespace hashing;
+using namespace perfhash;
+
+template <typename KeyStorage>
+bool view_matches_map(const std::string& path) {
+    std::vector<std::pair<uint64_t, uint64_t>> l;
+    for (uint64_t i = 0; i < 1000; i++)
+        l.push_back(std::make_pair(i * 7919, i));
+
+    perfect_hash_map<uint64_t, uint64_t, ru_hash_family<uint64_t>,
+        std::allocator<std::pair<const uint64_t, uint64_t>>, fks_engine,
+        KeyStorage> h(l.begin(), l.end());
+    h.save(path);
+    perfect_hash_map_view<uint64_t, uint64_t, ru_hash_family<uint64_t>,
+        fks_engine, KeyStorage> v(path);
+
+    // Most of these keys are missing, and with fingerprint_keys or no_keys
+    // some are false positives, which the view must report all the same.
+    for (uint64_t k = 0; k < 100000; k++) {
+        const uint64_t* a = h.find(k);
+        const uint64_t* b = v.find(k);
+        if ((a == nullptr) != (b == nullptr) || (a && *a != *b))
+            return false;
+    }
+    return true;
+}
+
+// Updates only rebuild the buckets they touch, so a run of small ones should
+// take a fraction of one full build, however large the map is.
+bool updates_scale_with_delta() {
+    using clock = std::chrono::steady_clock;
+    splitmix64 rng;
+    rng.seed(1);
+
+    std::vector<std::pair<uint64_t, uint64_t>> l;
+    for (uint64_t i = 0; i < 1000000; i++)
+        l.push_back(std::make_pair(rng(), i));
+
+    build_options options;
+    options.iterable = true;
+    clock::time_point start = clock::now();
+    perfect_hash_map<uint64_t, uint64_t> h(l.begin(), l.end(), options);
+    clock::duration build = clock::now() - start;
+
+    clock::duration updates{};
+    for (size_t round = 0; round <= 20; round++) {
+        std::vector<std::pair<uint64_t, uint64_t>> added;
+        std::vector<uint64_t> removed;
+        for (size_t i = 0; i < 1000; i++) {
+            removed.push_back(l[round * 1000 + i].first);
+            added.push_back(std::make_pair(rng(), i));
+        }
+        start = clock::now();
+        h.update(added, removed);
+        // The first update indexes the whole map, once.
+        if (round > 0) updates += clock::now() - start;
+    }
+    return updates < build;
+}
 
 int main(int argc, char** argv) {
     std::cout << "[start]" << std::endl;
@@ -30,6 +90,38 @@ int main(int argc, char** argv) {
         std::cout << e.what() << std::endl;
     }
 
+    std::vector<std::pair<int, std::string>> added;
+    added.push_back(std::make_pair(180, "v180"));
+    added.push_back(std::make_pair(9, "d"));
+    h.update(added, std::vector<int>{ 1 });
+
+    std::cout << h.at(180) << std::endl;
+    std::cout << h.at(9) << std::endl;
+    std::cout << h.contains(1) << std::endl;
+
+    if (h.at(180) != "v180" || h.at(9) != "d" || h.contains(1)) {
+        std::cout << "update lost a value" << std::endl;
+        return 1;
+    }
+
+    std::string path =
+        (std::filesystem::temp_directory_path() / "perfhash_main.bin").string();
+    bool matches = view_matches_map<stored_keys>(path)
+        && view_matches_map<fingerprint_keys<uint8_t>>(path)
+        && view_matches_map<no_keys>(path);
+    std::filesystem::remove(path);
+    if (!matches) {
+        std::cout << "view disagrees with the map it was saved from"
+                  << std::endl;
+        return 1;
+    }
+
+    if (!updates_scale_with_delta()) {
+        std::cout << "small updates took longer than a full build"
+                  << std::endl;
+        return 1;
+    }
+
     std::cout << "[end]" << std::endl;
     std::cout << "[start]" << std::endl;
 
@@ -9,320 +9,6702 @@
  */
 
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <random>
 #include <vector>
-#include <list>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+#include <optional>
 #include <type_traits>
+#include <utility>
 #include <cassert>
+#include <cstdint>
+#include <cmath>
+#include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 namespace perfhash {
     using hash_t = size_t;
 
-    inline static unsigned int log2(size_t value) {
-        unsigned int log;
-        for (log = 0; value != 0; log++) value >>= 1;
+    inline static constexpr unsigned int log2(size_t value) {
+        unsigned int log = 0;
+        for (; value != 0; log++) value >>= 1;
         return log;
     }
 
     /**
-     * @brief Standard randomized universal hash functor.
+     * @brief Smallest power of two not less than a value.
+     */
+    inline constexpr size_t ceil_pow2(size_t value) {
+        size_t power = 1;
+        while (power < value) power *= 2;
+        return power;
+    }
+
+    /**
+     * @brief High 64 bits of the 128-bit product of two 64-bit integers.
+     */
+    inline constexpr uint64_t mulhi64(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+        // Spelled through __extension__ so -Wpedantic builds stay quiet.
+        __extension__ typedef unsigned __int128 uint128_t;
+        return uint64_t(uint128_t(a) * b >> 64);
+#else
+        uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+        uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+        uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+        uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + a_lo * b_hi;
+        return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+    }
+
+    /**
+     * @brief Maps a 64-bit hash uniformly onto [0, n) without a division.
+     */
+    inline constexpr uint64_t reduce(uint64_t hash, uint64_t n) {
+        return mulhi64(hash, n);
+    }
+
+    /**
+     * @brief 64-bit finalizer mix (from MurmurHash3).
      * 
-     * @tparam Key type of key to be hashed.
+     * A bijection that spreads every input bit over the whole output.
      */
-    template <
-        typename Key,
-        template <typename>
-        typename RandomDistribution = std::uniform_int_distribution,
-        typename RandomDevice = std::random_device,
-        typename RNG = std::mt19937,
-        typename Enable = void
-    > struct ru_hash_function {
-        using random_device_t = RandomDevice;
+    inline constexpr uint64_t mix64(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDULL;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ULL;
+        x ^= x >> 33;
+        return x;
+    }
 
-        RNG rng;
-        size_t M;
-        void seed(RandomDevice& rd);
-        void rehash();
-        hash_t operator()(const Key& key) const;
-    };
+    /**
+     * @brief Hints the processor to start loading an address into cache.
+     */
+    inline void prefetch(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(address);
+#else
+        (void) address;
+#endif
+    }
 
     /**
-     * @brief Standard randomized universal hash functor for integers.
+     * @brief SplitMix64 pseudo-random number generator.
      * 
-     * @tparam Integer type of integral number to be hashed.
+     * Has a single word of state, so seeding is free. This makes it cheap to
+     * give every bucket of a container its own deterministically seeded
+     * generator.
      */
-    template <
-        typename Integer,
-        template <typename> typename RandomDistribution,
-        typename RandomDevice,
-        typename RNG
-    > struct ru_hash_function <
-        Integer,
-        RandomDistribution,
-        RandomDevice,
-        RNG,
-        typename std::enable_if_t<std::is_integral_v<Integer>>
-    > {
-        using random_device_t = RandomDevice;
-        static constexpr size_t w = sizeof(Integer) * 8;
+    class splitmix64 {
+    public:
+        using result_type = uint64_t;
 
-        RNG rng;
-        size_t M;
+        constexpr explicit splitmix64(uint64_t seed = 0) : m_state(seed) {}
 
-        RandomDistribution<Integer> rdist;
-        Integer a, b;
+        constexpr void seed(uint64_t seed) {
+            m_state = seed;
+        }
 
-        void seed(RandomDevice& rd) {
-            rng.seed(rd());
-            rehash();
+        static constexpr result_type min() {
+            return 0;
         }
 
-        void rehash() {
-            a = rdist(rng);
-            b = rdist(rng) >> M;
+        static constexpr result_type max() {
+            return UINT64_MAX;
         }
 
-        hash_t operator()(const Integer& key) const {
-            return unsigned(a * key + b) >> (w - M);
+        constexpr result_type operator()() {
+            uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
         }
+    private:
+        uint64_t m_state;
     };
 
     /**
-     * @brief Static collision-free hash map.
-     * 
-     * Implemented using FKS two-tiered hashing.
+     * @brief Error raised when a container can't be built.
      * 
-     * @tparam Key type of key used in the map.
-     * @tparam Value type of value stored in the map.
-     * @tparam RandomizedUniversalHash randomized universal hashing function.
+     * Thrown when no collision-free layout is found within the bounds set by
+     * build_options (e.g. because the keys have duplicates, or the hash
+     * family can't tell some of them apart), or when construction runs past
+     * build_options::timeout.
      */
-    template <
-        typename Key,
-        typename Value,
-        typename RUHashFunction = ru_hash_function<Key>,
-        typename Allocator = std::allocator<std::pair<Key, Value>>,
-        std::enable_if_t<std::is_copy_constructible_v<Key>, int> = 0,
-        std::enable_if_t<std::is_default_constructible_v<Value>, int> = 0,
-        std::enable_if_t<std::is_copy_constructible_v<Value>, int> = 0
-    > class perfect_hash_map {
+    class build_error : public std::runtime_error {
     public:
-        using key_type = Key;
-        using mapped_type = Value;
-        using value_type = std::pair<key_type, mapped_type>;
-        using size_type = size_t;
-        using allocator_type = Allocator;
-        using reference = Value&;
-        using const_reference = const Value&;
-        using pointer = typename std::allocator_traits<allocator_type>::pointer;
-        using const_pointer = typename std::allocator_traits<allocator_type>::const_pointer;
-        using hash_function = RUHashFunction;
+        using std::runtime_error::runtime_error;
+    };
 
-        perfect_hash_map() = delete;
-        perfect_hash_map(const perfect_hash_map&) = default;
-        perfect_hash_map(perfect_hash_map&&) = default;
+    /**
+     * @brief Options controlling how a container is built.
+     */
+    struct build_options {
+        /**
+         * @brief Number of threads used for construction.
+         * 
+         * Zero means one per hardware thread. The built container does not
+         * depend on the number of threads.
+         */
+        unsigned threads = 1;
 
         /**
-         * @brief Range constructor.
+         * @brief Whether to keep an index of the populated slots.
          * 
-         * Constructs a container with as many elements as the range
-         * [first,last), with each element constructed from its corresponding
-         * element in that range.
+         * The index costs one size_t per element and is what begin() and
+         * end() iterate over. Without it, maps iterate as if empty.
+         */
+        bool iterable = true;
+
+        /**
+         * @brief Keys per first-level bucket, for the FKS engines.
          * 
-         * @tparam Iterator STL iterator for a collection type.
-         * @param first Iterator to the initial position in a range.
-         * @param last Iterator to the final position in a range.
-         * @param allocator Allocator object.
+         * Higher values mean fewer bucket headers, but larger buckets, whose
+         * second-level tables grow with the square of their size.
          */
-        template <typename Iterator>
-        perfect_hash_map(Iterator first, Iterator last,
-                         const allocator_type& allocator = allocator_type()) {
-            m_hash.M = log2(std::distance(first, last));
-            m_hash.seed(m_random_device);
-            m_buckets.resize(1ULL << m_hash.M,
-                SubHash(m_random_device, allocator));
-            populate(first, last);
-        }
+        double load_factor = 1.0;
 
         /**
-         * @brief Initializer list constructor.
+         * @brief Second-level slots per squared bucket size, for the FKS
+         *  engines.
          * 
-         * @param values An initializer_list object.
-         * @param allocator Allocator object.
+         * A bucket of l keys gets `max(l, ceil(secondary_scale * l * l))`
+         * slots. Lower values waste fewer slots, at the cost of more retries
+         * to find a collision-free function.
          */
-        perfect_hash_map(const std::initializer_list<value_type>& values,
-                         const allocator_type& allocator = allocator_type()) {
-            this(values.begin(), values.end(), allocator);
-        }
-        
+        double secondary_scale = 1.0;
+
         /**
-         * @brief Copy assignment operator.
+         * @brief Failed functions a second-level table is given before it is
+         *  grown, for the FKS engines.
          * 
-         * @param other An object of the same type.
-         * @return perfect_hash_map& *this.
+         * Every time a bucket exhausts its budget, its table doubles, up to
+         * 4 l^2 slots for l keys (or its initial size, if larger). A bucket
+         * exhausting its budget at that size fails the build with
+         * build_error. Bounds the time spent on any bucket, however low
+         * secondary_scale is or however poorly the keys hash.
          */
-        perfect_hash_map& operator=(const perfect_hash_map& other) = default;
-        
+        size_t retry_budget = 64;
+
         /**
-         * @brief Move assignment operator.
+         * @brief Time after which construction gives up with build_error.
          * 
-         * @param other An object of the same type.
-         * @return perfect_hash_map& *this.
+         * Checked between retries and between phases, so construction stops
+         * shortly after the deadline rather than exactly on it. Unset means
+         * no limit.
          */
-        perfect_hash_map& operator=(perfect_hash_map&& other) = default;
+        std::optional<std::chrono::duration<double>> timeout;
 
-        ~perfect_hash_map() = default;
+        /**
+         * @brief Whether to back large tables with huge pages, where the OS
+         *  supports it (see page_buffer).
+         */
+        bool huge_pages = true;
 
         /**
-         * @brief Safe access element.
+         * @brief Memory resource for temporary construction buffers.
          * 
-         * @param key Key for the element.
-         * @return const_reference A reference to the mapped value.
+         * Buffers are carved out of monotonic arenas drawing from this
+         * resource, and all released when construction is done. Null means
+         * the default resource.
+         */
+        std::pmr::memory_resource* scratch = nullptr;
+
+        /**
+         * @brief Seed for every random choice made during construction.
          * 
-         * @throw std::out_of_range If there's no matching key in the
-         *  container.
-         * @see operator[]
+         * All functions are drawn from counter-based generators derived from
+         * the seed, so a given set of keys always gets the same layout,
+         * whatever the number of threads. Unset means drawing a seed from
+         * the hash family's random device, once per build.
          */
-        const_reference at(const key_type& key) const {
-            hash_t h = m_hash(key);
-            assert(h < m_buckets.size());
-            return m_buckets[h].at(key);
-        }
+        std::optional<uint64_t> seed;
 
-        reference at(const key_type& key) {
-            hash_t h = m_hash(key);
-            assert(h < m_buckets.size());
-            return m_buckets[h].at(key);
+        std::pmr::memory_resource* scratch_resource() const {
+            return scratch ? scratch : std::pmr::get_default_resource();
         }
+    };
+
+    /**
+     * @brief Statistics collected while building a container.
+     */
+    struct build_statistics {
+        using duration = std::chrono::duration<double>;
 
         /**
-         * @brief Access element.
-         * 
-         * @param key Key for the element.
-         * @return const_reference A reference to the mapped value.
+         * @brief Number of keys in the container.
+         */
+        size_t keys = 0;
+
+        /**
+         * @brief Number of first-level buckets.
+         */
+        size_t buckets = 0;
+
+        /**
+         * @brief Histogram of bucket sizes: `bucket_sizes[l]` is the number of
+         *  buckets holding l keys.
+         */
+        std::vector<size_t> bucket_sizes;
+
+        /**
+         * @brief Number of slots addressed by the engine.
+         */
+        size_t slots = 0;
+
+        /**
+         * @brief Bytes of engine metadata (functions, bucket headers,
+         *  pilots), not counting the slot array.
+         */
+        size_t metadata = 0;
+
+        /**
+         * @brief Histogram of retries per non-empty bucket.
          * 
-         * @note If the container has no matching key, this operator has
-         *  undefined behavior.
-         * @see at
+         * Retries are failed do_perfect() trials for fks_engine, and failed
+         * pilots for chd_engine. Bins grow exponentially: `retries[k]` counts
+         * buckets that needed r retries with `log2(r) == k`, i.e. bin 0 is
+         * r = 0 and bin k is r in [2^(k-1), 2^k).
          */
-        const_reference operator[](const key_type& key) const {
-            hash_t h = m_hash(key);
-            assert(h < m_buckets.size());
-            return m_buckets[h][key];
+        std::vector<size_t> retries;
+
+        /**
+         * @brief Retries over all buckets.
+         */
+        size_t total_retries = 0;
+
+        /**
+         * @brief Retries of the worst bucket.
+         */
+        size_t max_retries = 0;
+
+        /**
+         * @brief Times construction started over with a new first-level
+         *  function.
+         */
+        size_t restarts = 0;
+
+        /**
+         * @brief Buckets whose second-level table was grown after exhausting
+         *  build_options::retry_budget.
+         */
+        size_t grown_buckets = 0;
+
+        /**
+         * @brief Wall time spent hashing keys into first-level buckets.
+         */
+        duration partition_time{};
+
+        /**
+         * @brief Wall time spent searching for collision-free functions.
+         */
+        duration search_time{};
+
+        /**
+         * @brief Wall time spent moving elements into their slots.
+         */
+        duration placement_time{};
+
+        /**
+         * @brief Bits of engine metadata per key.
+         */
+        double bits_per_key() const {
+            return keys == 0 ? 0 : 8.0 * double(metadata) / double(keys);
         }
 
-        reference operator[](const key_type& key) {
-            hash_t h = m_hash(key);
-            assert(h < m_buckets.size());
-            return m_buckets[h][key];
+        /**
+         * @brief Records a bucket of `size` keys, placed after `tries` retries.
+         */
+        void add_bucket(size_t size, size_t tries) {
+            if (bucket_sizes.size() <= size) bucket_sizes.resize(size + 1);
+            bucket_sizes[size]++;
+            if (size == 0) return;
+
+            size_t bin = log2(tries);
+            if (retries.size() <= bin) retries.resize(bin + 1);
+            retries[bin]++;
+            total_retries += tries;
+            max_retries = std::max(max_retries, tries);
+        }
+    };
+
+    /**
+     * @brief Estimated number of bytes the allocator spends on bookkeeping for
+     *  each heap block.
+     */
+    inline constexpr size_t allocation_overhead = 2 * sizeof(void*);
+
+    /**
+     * @brief Heap memory held by a vector, including allocator overhead.
+     */
+    template <typename T, typename Allocator>
+    size_t memory_usage(const std::vector<T, Allocator>& v) {
+        if (v.capacity() == 0) return 0;
+        return v.capacity() * sizeof(T) + allocation_overhead;
+    }
+
+    /**
+     * @brief Measures the wall time of a scope into a duration.
+     */
+    class scoped_timer {
+    public:
+        explicit scoped_timer(build_statistics::duration& out)
+            : m_out(out), m_start(std::chrono::steady_clock::now()) {}
+
+        ~scoped_timer() {
+            m_out += std::chrono::steady_clock::now() - m_start;
         }
     private:
-        using random_device_t = typename hash_function::random_device_t;
+        build_statistics::duration& m_out;
+        std::chrono::steady_clock::time_point m_start;
+    };
 
-        struct SubHash {
-            hash_function hash;
-            std::vector<value_type, allocator_type> buckets;
+    /**
+     * @brief Deadline of a build, as set by build_options::timeout.
+     */
+    class build_deadline {
+    public:
+        explicit build_deadline(const build_options& options) {
+            if (options.timeout)
+                m_end = std::chrono::steady_clock::now()
+                    + std::chrono::duration_cast<
+                        std::chrono::steady_clock::duration>(*options.timeout);
+        }
 
-            SubHash(random_device_t& random_device,
-                    const allocator_type& allocator)
-                : buckets(allocator) {
-                hash.seed(random_device);
-            }
+        /**
+         * @throw build_error If the deadline has passed.
+         */
+        void check() const {
+            if (m_end && std::chrono::steady_clock::now() > *m_end)
+                throw build_error("Perfect hash build timed out");
+        }
+    private:
+        std::optional<std::chrono::steady_clock::time_point> m_end;
+    };
 
-            void resize(size_t size) {
-                size_t M = log2(size);
-                hash.M = M;
-                buckets.resize(1ULL << M);
-            }
+    /**
+     * @brief Number of threads parallel_for() runs on for the same arguments.
+     */
+    inline unsigned worker_count(unsigned threads, size_t n,
+                                 size_t chunk = 1024) {
+        if (threads == 0) threads = std::max(1u,
+            std::thread::hardware_concurrency());
+        if (n <= chunk) return 1;
+        return unsigned(std::min<size_t>(threads, (n + chunk - 1) / chunk));
+    }
 
-            void rehash() {
-                hash.rehash();
-            }
+    /**
+     * @brief Runs `body(i)` for every i in [0, n) on up to `threads` threads.
+     * 
+     * Indices are handed out in chunks from a shared counter, so threads that
+     * run into cheap work keep taking more instead of idling on a fixed
+     * partition. The first exception thrown by `body` is rethrown once all
+     * threads are done.
+     * 
+     * `body` may also take the index of the thread running it, in
+     * [0, worker_count()), as a second argument, e.g. to pick per-thread
+     * scratch space.
+     */
+    template <typename Body>
+    void parallel_for(unsigned threads, size_t n, const Body& body,
+                      size_t chunk = 1024) {
+        auto call = [&](size_t i, unsigned t) {
+            if constexpr (std::is_invocable_v<const Body&, size_t, unsigned>)
+                body(i, t);
+            else
+                body(i);
+        };
 
-            void clear() {
-                buckets.clear();
-            }
-            
-            void add(const value_type& pair) {
-                buckets[hash(pair.first)] = pair;
+        threads = worker_count(threads, n, chunk);
+        if (threads == 1) {
+            for (size_t i = 0; i < n; i++) call(i, 0);
+            return;
+        }
+
+        std::atomic<size_t> next(0);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto worker = [&](unsigned t) {
+            try {
+                for (;;) {
+                    size_t begin = next.fetch_add(chunk);
+                    if (begin >= n) return;
+                    size_t end = std::min(n, begin + chunk);
+                    for (size_t i = begin; i < end; i++) call(i, t);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) error = std::current_exception();
+                next = n;
             }
+        };
 
-            const_reference at(const key_type& key) const {
-                hash_t h = hash(key);
-                if (h >= buckets.size()) throw std::out_of_range("No such key");
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker, t);
+        worker(0);
+        for (auto& thread : pool) thread.join();
+        if (error) std::rethrow_exception(error);
+    }
 
-                const value_type& pair = buckets[h];
-                if (pair.first != key) throw std::out_of_range("No such key");
-                return pair.second;
-            }
+    /**
+     * @brief Largest number of values all_distinct() is meant for.
+     */
+    inline constexpr size_t all_distinct_limit = 8;
 
-            reference at(const key_type& key) {
-                hash_t h = hash(key);
-                if (h >= buckets.size()) throw std::out_of_range("No such key");
+    /**
+     * @brief Whether the first `n` of `values` are pairwise distinct.
+     * 
+     * Compares every pair and folds the results without branching, which
+     * the compiler can vectorize. For a handful of values, that is cheaper
+     * than setting bits in any set.
+     */
+    inline bool all_distinct(const size_t* values, size_t n) {
+        assert(n <= all_distinct_limit);
+        bool clash = false;
+        for (size_t i = 1; i < n; i++)
+            for (size_t j = 0; j < i; j++)
+                clash |= values[i] == values[j];
+        return !clash;
+    }
 
-                value_type& pair = buckets[h];
-                if (pair.first != key) throw std::out_of_range("No such key");
-                return pair.second;
-            }
-            
-            const_reference operator[](const key_type& key) const {
-                return buckets[hash(key)].second;
-            }
+    /**
+     * @brief Bitmap of slots for collision checks.
+     * 
+     * Over large ranges, remembers which words it set, so clearing takes
+     * time proportional to the number of insertions rather than to the
+     * number of slots; small ranges are cheaper to just zero-fill. One set
+     * can then be reused for every trial of every bucket, and is only
+     * zero-filled as a whole when it grows.
+     */
+    class slot_set {
+    public:
+        explicit slot_set(std::pmr::memory_resource* resource =
+                              std::pmr::get_default_resource())
+            : m_bits(resource), m_inserted(resource) {}
 
-            reference operator[](const key_type& key) {
-                return buckets[hash(key)].second;
-            }
+        /**
+         * @brief Sets the range of slots to [0, slots), with room for
+         *  `keys` insertions. The set must be empty.
+         */
+        void resize(size_t slots, size_t keys) {
+            m_words = (slots + 63) / 64;
+            if (m_bits.size() < m_words) m_bits.resize(m_words, 0);
+            m_tracked = m_words > untracked_words;
+            if (m_tracked && m_inserted.size() < keys)
+                m_inserted.resize(keys);
+        }
 
-            size_t capacity() const {
-                return buckets.size();
-            }
-        };
-        
-        hash_function m_hash;
-        random_device_t m_random_device;
-        std::vector<SubHash> m_buckets;
-        std::list<key_type> m_keys;
+        /**
+         * @brief Inserts a slot.
+         * 
+         * @return bool Whether the slot was not in the set yet.
+         */
+        bool insert(size_t slot) {
+            uint64_t& word = m_bits[slot / 64];
+            uint64_t bit = uint64_t(1) << (slot % 64);
+            if (word & bit) return false;
+            word |= bit;
+            if (m_tracked) m_inserted[m_count++] = slot / 64;
+            return true;
+        }
 
-        template <typename Iterator>
-        void populate(const Iterator& first, const Iterator& last) {
-            std::vector<std::vector<value_type>> hashed(m_buckets.size());
-            for (auto it = first; it != last; it++) {
-                m_keys.push_back(it->first);
-                hash_t h = m_hash(it->first);
-                assert(h < hashed.size());
-                hashed[h].push_back(*it);
+        void clear() {
+            if (!m_tracked) {
+                std::fill(m_bits.begin(), m_bits.begin() + m_words, 0);
+                return;
             }
-
-            for (size_t i = 0; i < m_buckets.size(); i++) {
-                auto& bucket = m_buckets[i];
-                auto& elements = hashed[i];
-                if (elements.empty()) continue;
-
-                size_t l = elements.size();
-                bucket.resize(l * l);
-                do_perfect(bucket, elements);
-            }
-        }
-
-        void do_perfect(SubHash& bucket,
-                   const std::vector<value_type>& elements) {
-            bool collision;
-            std::vector<bool> dummy(bucket.capacity());
-            do {
-                collision = false;
-                for (auto& e : elements) {
-                    hash_t h = bucket.hash(e.first);
-                    assert(h < dummy.size());
-                    if (dummy[h]) {
-                        collision = true;
-                        std::fill(dummy.begin(), dummy.end(), false);
-                        bucket.rehash();
-                        break;
-                    } else {
-                        dummy[h] = true;
-                    }
-                }
-            } while (collision);
-            for (auto& e : elements) bucket.add(e);
+            for (size_t i = 0; i < m_count; i++) m_bits[m_inserted[i]] = 0;
+            m_count = 0;
         }
+    private:
+        static constexpr size_t untracked_words = 8;
+
+        std::pmr::vector<uint64_t> m_bits;
+        std::pmr::vector<size_t> m_inserted;
+        size_t m_words = 0;
+        size_t m_count = 0;
+        bool m_tracked = false;
     };
-};
+
+    /**
+     * @brief Standard randomized universal hash functor.
+     * 
+     * Holds only the sampled parameters of the function, so it is trivially
+     * copyable and cheap to store per bucket. Instances are drawn from a
+     * matching ru_hash_family.
+     * 
+     * @tparam Key type of key to be hashed.
+     */
+    template <typename Key, typename Enable = void>
+    struct ru_hash_function {
+        size_t M;
+        constexpr hash_t operator()(const Key& key) const;
+    };
+
+    /**
+     * @brief Standard randomized universal hash functor for integers.
+     * 
+     * Dietzfelbinger's multiply-add-shift: with random a and b twice as wide
+     * as the key, `h(x) = ((a * x + b) mod 2^2w) >> (2w - M)` is strongly
+     * universal for any M up to w. Keys of up to 32 bits are computed in
+     * 64-bit arithmetic, and 64-bit keys in 128-bit arithmetic, with a and b
+     * stored as two words each. Since the output is the top of the full
+     * product, every key bit affects it and up to 64 bits are available.
+     * 
+     * @tparam Integer type of integral number to be hashed.
+     */
+    template <typename Integer>
+    struct ru_hash_function <
+        Integer,
+        typename std::enable_if_t<std::is_integral_v<Integer>
+            && sizeof(Integer) <= sizeof(uint64_t)>
+    > {
+        static constexpr size_t w = 64;
+        static constexpr size_t words = sizeof(Integer) <= 4 ? 1 : 2;
+
+        uint64_t a[words] = {}, b[words] = {};
+        size_t M = 0;
+
+        constexpr hash_t operator()(const Integer& key) const {
+            uint64_t x = uint64_t(std::make_unsigned_t<Integer>(key));
+            uint64_t h = 0;
+            if constexpr (words == 1) {
+                h = a[0] * x + b[0];
+            } else {
+                uint64_t lo = a[0] * x;
+                uint64_t sum = lo + b[0];
+                h = a[1] * x + mulhi64(a[0], x) + b[1] + (sum < lo);
+            }
+            return M == 0 ? 0 : h >> (w - M);
+        }
+    };
+
+    /**
+     * @brief Whether a type is a contiguous string of chars, hashed as raw
+     *  bytes.
+     */
+    template <typename T>
+    struct is_byte_string : std::false_type {};
+
+    template <typename Traits, typename Alloc>
+    struct is_byte_string<std::basic_string<char, Traits, Alloc>>
+        : std::true_type {};
+
+    template <typename Traits>
+    struct is_byte_string<std::basic_string_view<char, Traits>>
+        : std::true_type {};
+
+    template <typename T>
+    inline constexpr bool is_byte_string_v = is_byte_string<T>::value;
+
+    /**
+     * @brief Seeded hash functor for byte strings.
+     * 
+     * Consumes the key 16 bytes at a time, folding each pair of 8-byte words
+     * into the state with a full 64x64->128-bit multiply (wyhash-style), and
+     * keeps the top M bits of the result.
+     * 
+     * One word of the pair is masked with the seed and the other with the
+     * state, and the state is added back after the multiply. A word that
+     * zeroes its operand then only drops its pair, instead of everything
+     * hashed so far, and which words do that depends on the seed.
+     * 
+     * Accepts anything convertible to std::string_view, so maps keyed by
+     * std::string can be queried with a std::string_view or a C string
+     * without building a temporary std::string.
+     * 
+     * @tparam String type of string to be hashed.
+     */
+    template <typename String>
+    struct ru_hash_function <
+        String,
+        typename std::enable_if_t<is_byte_string_v<String>>
+    > {
+        using is_transparent = void;
+        static constexpr size_t w = 64;
+
+        uint64_t seed = 0;
+        size_t M = 0;
+
+        hash_t operator()(std::string_view key) const {
+            const char* p = key.data();
+            size_t n = key.size();
+
+            uint64_t secret = seed ^ k1;
+            uint64_t h = fold(seed ^ k0, n ^ k1);
+            for (; n > 16; n -= 16, p += 16)
+                h = absorb(h, secret, load64(p), load64(p + 8));
+
+            uint64_t a = 0, b = 0;
+            if (n >= 8) {
+                a = load64(p);
+                b = load64(p + n - 8);
+            } else if (n >= 4) {
+                a = load32(p);
+                b = load32(p + n - 4);
+            } else if (n > 0) {
+                a = uint64_t(uint8_t(p[0])) << 16
+                    | uint64_t(uint8_t(p[n / 2])) << 8
+                    | uint64_t(uint8_t(p[n - 1]));
+            }
+
+            h = fold(absorb(h, secret, a, b) ^ k2, key.size() ^ k1);
+            return M == 0 ? 0 : h >> (w - M);
+        }
+    private:
+        static constexpr uint64_t k0 = 0xA0761D6478BD642FULL;
+        static constexpr uint64_t k1 = 0xE7037ED1A0B428DBULL;
+        static constexpr uint64_t k2 = 0x8EBC6AF09C88C6E3ULL;
+
+        static uint64_t fold(uint64_t a, uint64_t b) {
+            return (a * b) ^ mulhi64(a, b);
+        }
+
+        static uint64_t absorb(uint64_t h, uint64_t secret,
+                               uint64_t a, uint64_t b) {
+            return fold(a ^ secret, b ^ h) + h;
+        }
+
+        static uint64_t load64(const char* p) {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static uint64_t load32(const char* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+    };
+
+    /**
+     * @brief Randomized universal hash family.
+     * 
+     * Build-time sampler for ru_hash_function. Owns the random number
+     * generator, which is only needed while a container is being built.
+     * 
+     * @tparam Key type of key to be hashed.
+     */
+    template <
+        typename Key,
+        template <typename>
+        typename RandomDistribution = std::uniform_int_distribution,
+        typename RandomDevice = std::random_device,
+        typename RNG = splitmix64,
+        typename Enable = void
+    > struct ru_hash_family {
+        using hash_function = ru_hash_function<Key>;
+        using random_device_t = RandomDevice;
+
+        RNG rng;
+        void seed(RandomDevice& rd);
+        void seed(uint64_t seed);
+        hash_function sample(size_t M);
+    };
+
+    /**
+     * @brief Randomized universal hash family for integers.
+     * 
+     * @tparam Integer type of integral number to be hashed.
+     */
+    template <
+        typename Integer,
+        template <typename> typename RandomDistribution,
+        typename RandomDevice,
+        typename RNG
+    > struct ru_hash_family <
+        Integer,
+        RandomDistribution,
+        RandomDevice,
+        RNG,
+        typename std::enable_if_t<std::is_integral_v<Integer>>
+    > {
+        using hash_function = ru_hash_function<Integer>;
+        using random_device_t = RandomDevice;
+
+        RNG rng;
+        RandomDistribution<uint64_t> rdist;
+
+        void seed(RandomDevice& rd) {
+            rng.seed(rd());
+        }
+
+        void seed(uint64_t seed) {
+            rng.seed(typename RNG::result_type(seed));
+        }
+
+        /**
+         * @brief Draws a function from the family.
+         * 
+         * @param M number of output bits.
+         * @return hash_function A function mapping keys to [0, 2^M).
+         */
+        hash_function sample(size_t M) {
+            hash_function f;
+            f.M = M;
+            for (auto& word : f.a) word = rdist(rng);
+            for (auto& word : f.b) word = rdist(rng);
+            return f;
+        }
+    };
+
+    /**
+     * @brief Seeded hash family for byte strings.
+     * 
+     * @tparam String type of string to be hashed.
+     */
+    template <
+        typename String,
+        template <typename> typename RandomDistribution,
+        typename RandomDevice,
+        typename RNG
+    > struct ru_hash_family <
+        String,
+        RandomDistribution,
+        RandomDevice,
+        RNG,
+        typename std::enable_if_t<is_byte_string_v<String>>
+    > {
+        using hash_function = ru_hash_function<String>;
+        using random_device_t = RandomDevice;
+
+        RNG rng;
+        RandomDistribution<uint64_t> rdist;
+
+        void seed(RandomDevice& rd) {
+            rng.seed(rd());
+        }
+
+        void seed(uint64_t seed) {
+            rng.seed(typename RNG::result_type(seed));
+        }
+
+        /**
+         * @brief Draws a function from the family.
+         * 
+         * @param M number of output bits.
+         * @return hash_function A function mapping keys to [0, 2^M).
+         */
+        hash_function sample(size_t M) {
+            hash_function f;
+            f.M = M;
+            f.seed = rdist(rng);
+            return f;
+        }
+    };
+
+    /**
+     * @brief Hash family ready to draw functions from.
+     * 
+     * @param seed Seed for the family's generator. If unset, one is read
+     *  from the family's random device.
+     */
+    template <typename HashFamily>
+    HashFamily seeded_family(const std::optional<uint64_t>& seed) {
+        HashFamily family;
+        if (seed) {
+            family.seed(*seed);
+        } else {
+            typename HashFamily::random_device_t random_device;
+            family.seed(random_device);
+        }
+        return family;
+    }
+
+    /**
+     * @brief Sequential writer for the binary container format.
+     * 
+     * Values are written as their in-memory bytes. Arrays are prefixed with
+     * their length and aligned to a cache line, so they can be used in place
+     * once the file is mapped back into memory.
+     */
+    class binary_writer {
+    public:
+        static constexpr size_t alignment = 64;
+
+        explicit binary_writer(std::ostream& os) : m_os(os) {}
+
+        template <typename T>
+        void write(const T& value) {
+            static_assert(std::is_trivially_copyable_v<T>,
+                "only trivially copyable values can be serialized");
+            write_bytes(&value, sizeof(T));
+        }
+
+        template <typename T>
+        void write_array(const T* data, size_t n) {
+            write(uint64_t(n));
+            pad();
+            write_bytes(data, n * sizeof(T));
+        }
+    private:
+        std::ostream& m_os;
+        size_t m_offset = 0;
+
+        void write_bytes(const void* data, size_t size) {
+            m_os.write(static_cast<const char*>(data), size);
+            if (!m_os) throw std::runtime_error("Could not write perfect hash");
+            m_offset += size;
+        }
+
+        void pad() {
+            static const char zeros[alignment] = {};
+            write_bytes(zeros, (alignment - m_offset % alignment) % alignment);
+        }
+    };
+
+    /**
+     * @brief Bounds-checked reader for the binary container format.
+     * 
+     * Arrays are not copied: read_array() returns a pointer into the
+     * underlying buffer, which must be aligned to binary_writer::alignment
+     * and outlive everything read from it.
+     */
+    class binary_reader {
+    public:
+        binary_reader(const char* data, size_t size)
+            : m_data(data), m_size(size) {}
+
+        template <typename T>
+        T read() {
+            static_assert(std::is_trivially_copyable_v<T>,
+                "only trivially copyable values can be deserialized");
+            require(sizeof(T));
+            T value;
+            std::memcpy(&value, m_data + m_offset, sizeof(T));
+            m_offset += sizeof(T);
+            return value;
+        }
+
+        template <typename T>
+        const T* read_array(size_t& n) {
+            n = size_t(read<uint64_t>());
+            m_offset += (binary_writer::alignment
+                - m_offset % binary_writer::alignment)
+                % binary_writer::alignment;
+            if (n > (m_size - std::min(m_offset, m_size)) / sizeof(T))
+                throw std::runtime_error("Truncated perfect hash");
+
+            const char* data = m_data + m_offset;
+            if (reinterpret_cast<uintptr_t>(data) % alignof(T) != 0)
+                throw std::runtime_error("Misaligned perfect hash");
+            m_offset += n * sizeof(T);
+            return reinterpret_cast<const T*>(data);
+        }
+    private:
+        const char* m_data;
+        size_t m_size;
+        size_t m_offset = 0;
+
+        void require(size_t size) {
+            if (m_offset > m_size || size > m_size - m_offset)
+                throw std::runtime_error("Truncated perfect hash");
+        }
+    };
+
+    /**
+     * @brief Header of a serialized container.
+     * 
+     * Files store containers exactly as they are laid out in memory, so they
+     * are only readable by builds with the same byte order, engine, and key,
+     * value and hash function layouts. All of those are checked on load.
+     */
+    struct file_header {
+        static constexpr uint32_t current_version = 4;
+        static constexpr uint32_t native_byte_order = 0x01020304;
+
+        char magic[8] = {'P', 'E', 'R', 'F', 'H', 'A', 'S', 'H'};
+        uint32_t version = current_version;
+        uint32_t byte_order = native_byte_order;
+        uint32_t engine = 0;
+        uint32_t hash_size = 0;
+        uint32_t key_size = 0;
+        uint32_t value_size = 0;
+        uint32_t slot_size = 0;
+        uint32_t key_storage = 0;
+
+        bool operator==(const file_header& other) const {
+            return std::memcmp(this, &other, sizeof(file_header)) == 0;
+        }
+    };
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * @brief Read-only memory mapping of a whole file.
+     */
+    class mapped_file {
+    public:
+        explicit mapped_file(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) throw std::runtime_error("Could not open " + path);
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error("Could not stat " + path);
+            }
+
+            m_size = size_t(st.st_size);
+            if (m_size > 0) {
+                void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (data == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error("Could not map " + path);
+                }
+                m_data = static_cast<const char*>(data);
+            }
+            ::close(fd);
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        ~mapped_file() {
+            if (m_data) ::munmap(const_cast<char*>(m_data), m_size);
+        }
+
+        const char* data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+    private:
+        const char* m_data = nullptr;
+        size_t m_size = 0;
+    };
+#endif
+
+    /**
+     * @brief Zero-filled buffer aligned to a cache line.
+     * 
+     * Buffers of at least huge_page_size can ask to be backed by huge pages,
+     * which Linux grants through transparent huge pages: a table spanning
+     * gigabytes then needs one TLB entry per 2 MB instead of per 4 KB.
+     * Elsewhere the request is ignored.
+     */
+    class page_buffer {
+    public:
+        static constexpr size_t alignment = 64;
+        static constexpr size_t huge_page_size = size_t(2) << 20;
+
+        page_buffer() = default;
+
+        /**
+         * @brief Allocates a buffer.
+         * 
+         * @param size Size of the buffer, in bytes.
+         * @param huge_pages Whether to ask for huge pages.
+         * 
+         * @throw std::bad_alloc If the memory can't be allocated.
+         */
+        page_buffer(size_t size, bool huge_pages) {
+            allocate(size, huge_pages && size >= huge_page_size);
+        }
+
+        page_buffer(const page_buffer& other) {
+            allocate(other.m_size, other.m_huge_pages);
+            if (m_size > 0) std::memcpy(m_data, other.m_data, m_size);
+        }
+
+        page_buffer(page_buffer&& other) noexcept {
+            swap(other);
+        }
+
+        page_buffer& operator=(page_buffer other) noexcept {
+            swap(other);
+            return *this;
+        }
+
+        ~page_buffer() {
+            release();
+        }
+
+        void swap(page_buffer& other) noexcept {
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            std::swap(m_mapped, other.m_mapped);
+            std::swap(m_huge_pages, other.m_huge_pages);
+        }
+
+        void* data() {
+            return m_data;
+        }
+
+        const void* data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+        /**
+         * @brief Bytes held, including rounding to whole pages.
+         */
+        size_t capacity() const {
+            return m_mapped ? m_mapped : m_size + allocation_overhead;
+        }
+    private:
+        void* m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_mapped = 0;
+        bool m_huge_pages = false;
+
+        void allocate(size_t size, bool huge_pages) {
+            m_size = size;
+            m_huge_pages = huge_pages;
+            if (size == 0) return;
+
+#if defined(__unix__) || defined(__APPLE__)
+            if (huge_pages) {
+                // Huge pages must be aligned to their size, which mmap
+                // doesn't promise: map one more than needed and trim.
+                size_t length = (size + huge_page_size - 1)
+                    / huge_page_size * huge_page_size;
+                void* raw = ::mmap(nullptr, length + huge_page_size,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+                if (raw == MAP_FAILED) throw std::bad_alloc();
+
+                uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+                uintptr_t aligned = (start + huge_page_size - 1)
+                    / huge_page_size * huge_page_size;
+                if (aligned > start) ::munmap(raw, aligned - start);
+                ::munmap(reinterpret_cast<void*>(aligned + length),
+                         start + huge_page_size - aligned);
+#if defined(MADV_HUGEPAGE)
+                ::madvise(reinterpret_cast<void*>(aligned), length,
+                          MADV_HUGEPAGE);
+#endif
+                m_data = reinterpret_cast<void*>(aligned);
+                m_mapped = length;
+                return;
+            }
+#endif
+            m_data = ::operator new(size, std::align_val_t(alignment));
+            std::memset(m_data, 0, size);
+        }
+
+        void release() {
+            if (!m_data) return;
+#if defined(__unix__) || defined(__APPLE__)
+            if (m_mapped) {
+                ::munmap(m_data, m_mapped);
+                return;
+            }
+#endif
+            ::operator delete(m_data, std::align_val_t(alignment));
+        }
+    };
+
+    /**
+     * @brief FKS two-tiered construction engine.
+     * 
+     * Maps every key of a static set to a distinct slot in [0, capacity()).
+     * A first-level function partitions the keys into buckets, and each
+     * bucket of l keys gets a collision-free second-level table of about l^2
+     * slots. All second-level tables are laid out back to back, so a bucket
+     * only records where its table starts, its size and the function
+     * addressing it.
+     * 
+     * Neither level is restricted to powers of two: full-width hashes are
+     * mapped onto the number of buckets or slots with reduce(). Buckets of a
+     * single key get a single slot, and lookups skip their second-level
+     * function altogether.
+     * 
+     * @tparam Key type of key to be hashed.
+     * @tparam HashFamily randomized universal hash family.
+     */
+    template <typename Key, typename HashFamily>
+    class fks_engine {
+        struct bucket_header;
+    public:
+        using key_type = Key;
+        using size_type = size_t;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+
+        static constexpr size_type npos = size_type(-1);
+        static constexpr uint32_t tag = 0x534B46; // "FKS"
+
+        /**
+         * @brief Whether single buckets can be rebuilt (see rebuild_bucket).
+         */
+        static constexpr bool incremental = true;
+
+        /**
+         * @brief Query side of the engine.
+         * 
+         * Refers to the engine's arrays without owning them, so it can just
+         * as well address an engine mapped in from a file.
+         */
+        class view_type {
+        public:
+            /**
+             * @brief Number of slots addressed by the engine.
+             */
+            size_type capacity() const {
+                return m_capacity;
+            }
+
+            /**
+             * @brief Slot of a key in the set.
+             * 
+             * @note If the key is not in the set, the result is unspecified.
+             */
+            template <typename K>
+            size_type slot(const K& key) const {
+                const bucket_header& bucket = m_buckets[bucket_of(key)];
+                return bucket.offset + bucket.slot(key);
+            }
+
+            /**
+             * @brief Slot a key would occupy, if it were in the set.
+             * 
+             * @return size_type A slot in [0, capacity()), or npos if the key
+             *  is certainly not in the set.
+             */
+            template <typename K>
+            size_type probe(const K& key) const {
+                const bucket_header& bucket = m_buckets[bucket_of(key)];
+                if (bucket.offset == npos) return npos;
+                return bucket.offset + bucket.slot(key);
+            }
+
+            /**
+             * @brief Probes a batch of keys.
+             * 
+             * Same as calling probe() for every key, but software-pipelined:
+             * first-level hashes are all computed and their bucket headers
+             * prefetched before any header is read, so the header misses
+             * overlap instead of adding up. Each key still takes its own
+             * multiplies and a dependent load, so this is not SIMD code.
+             * 
+             * @param keys Keys to probe.
+             * @param n Number of keys.
+             * @param out Output slots, one per key.
+             */
+            void probe_many(const key_type* keys, size_type n,
+                            size_type* out) const {
+                for (size_type i = 0; i < n; i++) out[i] = bucket_of(keys[i]);
+                for (size_type i = 0; i < n; i++)
+                    prefetch(&m_buckets[out[i]]);
+                for (size_type i = 0; i < n; i++) {
+                    const bucket_header& bucket = m_buckets[out[i]];
+                    out[i] = bucket.offset == npos
+                        ? npos : bucket.offset + bucket.slot(keys[i]);
+                }
+            }
+
+            /**
+             * @brief Reads an engine written by fks_engine::save.
+             * 
+             * @throw std::runtime_error If the data is malformed.
+             */
+            static view_type load(binary_reader& reader) {
+                view_type view;
+                view.m_hash = reader.read<hash_function>();
+                view.m_capacity = reader.read<uint64_t>();
+                view.m_buckets = reader.read_array<bucket_header>(
+                    view.m_bucket_count);
+                if (view.m_bucket_count == 0
+                        || view.m_hash.M != hash_function::w)
+                    throw std::runtime_error("Malformed perfect hash");
+
+                // Every table must lie within the slot array.
+                for (size_type i = 0; i < view.m_bucket_count; i++) {
+                    const bucket_header& bucket = view.m_buckets[i];
+                    if (bucket.offset == npos) continue;
+                    if (bucket.size == 0 || bucket.offset >= view.m_capacity
+                            || bucket.size > view.m_capacity - bucket.offset
+                            || (bucket.size > 1
+                                && bucket.hash.M != hash_function::w))
+                        throw std::runtime_error("Malformed perfect hash");
+                }
+                return view;
+            }
+        private:
+            friend class fks_engine;
+
+            hash_function m_hash;
+            const bucket_header* m_buckets = nullptr;
+            size_type m_bucket_count = 0;
+            size_type m_capacity = 0;
+
+            template <typename K>
+            size_type bucket_of(const K& key) const {
+                return size_type(reduce(m_hash(key), m_bucket_count));
+            }
+        };
+
+        /**
+         * @brief Builds the engine for a set of keys.
+         * 
+         * @tparam KeyAt callable returning the i-th key of the set.
+         * @param n Number of keys in the set.
+         * @param key_at Accessor for the keys.
+         * @param family Hash family to draw functions from.
+         * @param options Build options, including the load factor of both
+         *  levels and the retry budget.
+         * @param stats Statistics to fill in.
+         * 
+         * @throw std::invalid_argument If a load factor or the retry budget
+         *  is not positive.
+         * @throw build_error If a bucket can't be placed within its budget,
+         *  or the build times out.
+         */
+        template <typename KeyAt>
+        void build(size_type n, const KeyAt& key_at, hash_family& family,
+                   const build_options& options, build_statistics& stats) {
+            validate(options);
+            build_deadline deadline(options);
+
+            m_secondary_scale = options.secondary_scale;
+            m_hash = family.sample(hash_function::w);
+            m_buckets.assign(std::max(size_type(1),
+                size_type(std::ceil(n / options.load_factor))),
+                bucket_header());
+            uint64_t salt = family.rng();
+            view_type params = view();
+
+            // Keys are counting-sorted by bucket into a single buffer, and
+            // every thread reuses one slot set sized for the largest bucket.
+            std::pmr::monotonic_buffer_resource arena(
+                options.scratch_resource());
+            std::pmr::vector<size_type> start(m_buckets.size() + 1, 0,
+                                              &arena);
+            std::pmr::vector<size_type> elements(n, &arena);
+            {
+                scoped_timer timer(stats.partition_time);
+                std::pmr::vector<size_type> buckets(n, &arena);
+                parallel_for(options.threads, n, [&](size_type i) {
+                    buckets[i] = params.bucket_of(key_at(i));
+                });
+
+                for (size_type b : buckets) {
+                    assert(b < m_buckets.size());
+                    start[b + 1]++;
+                }
+                std::partial_sum(start.begin(), start.end(), start.begin());
+
+                std::pmr::vector<size_type> cursor(start.begin(),
+                                                   start.end() - 1, &arena);
+                for (size_type i = 0; i < n; i++)
+                    elements[cursor[buckets[i]]++] = i;
+            }
+            deadline.check();
+
+            size_type largest = 0, longest = 0;
+            for (size_type i = 0; i < m_buckets.size(); i++) {
+                size_type l = start[i + 1] - start[i];
+                if (l == 0) continue;
+                m_buckets[i].size = table_size(l);
+                largest = std::max(largest, m_buckets[i].size);
+                longest = std::max(longest, l);
+            }
+
+            std::pmr::vector<size_type> retries(m_buckets.size(), 0, &arena);
+            {
+                scoped_timer timer(stats.search_time);
+                // The sets grow from worker threads, so they can't draw from
+                // the arena.
+                std::vector<slot_set> sets(worker_count(options.threads,
+                                                        m_buckets.size()));
+                for (slot_set& set : sets) set.resize(largest, longest);
+
+                // Each bucket draws from its own generator, seeded from its
+                // index, so the result doesn't depend on scheduling.
+                parallel_for(options.threads, m_buckets.size(),
+                    [&](size_type i, unsigned worker) {
+                        if (start[i] == start[i + 1]) return;
+
+                        hash_family local;
+                        local.seed(mix64(salt + i));
+                        retries[i] = do_perfect(m_buckets[i],
+                            &elements[start[i]], &elements[start[i + 1]],
+                            key_at, local, sets[worker],
+                            options.retry_budget, deadline);
+                    });
+            }
+
+            // Tables are only laid out once searched, since a bucket that
+            // exhausts its retry budget grows its table.
+            m_capacity = 0;
+            for (size_type i = 0; i < m_buckets.size(); i++) {
+                size_type l = start[i + 1] - start[i];
+                if (l == 0) continue;
+
+                auto& bucket = m_buckets[i];
+                bucket.offset = m_capacity;
+                m_capacity += bucket.size;
+                if (bucket.size > table_size(l)) stats.grown_buckets++;
+            }
+
+            stats.keys = n;
+            stats.buckets = m_buckets.size();
+            stats.slots = m_capacity;
+            stats.metadata = sizeof(m_hash)
+                + m_buckets.size() * sizeof(bucket_header);
+            for (size_type i = 0; i < m_buckets.size(); i++)
+                stats.add_bucket(start[i + 1] - start[i], retries[i]);
+        }
+
+        /**
+         * @brief Rebuilds a single bucket for a new set of keys.
+         * 
+         * The bucket keeps its second-level table if that is still large
+         * enough, otherwise a larger one is appended past capacity() and the
+         * old one is left unused. Either way the bucket's keys move, so they
+         * must all be placed again.
+         * 
+         * @tparam KeyAt callable returning the i-th key of the bucket.
+         * @param b Index of the bucket.
+         * @param n Number of keys, all of which must hash to bucket `b`.
+         * @param key_at Accessor for the keys.
+         * @param family Hash family to draw functions from.
+         * @param options Build options, for the retry budget and timeout.
+         * @return size_type Number of retries needed.
+         * 
+         * @throw build_error If the bucket can't be placed within its
+         *  budget, or the rebuild times out.
+         */
+        template <typename KeyAt>
+        size_type rebuild_bucket(size_type b, size_type n,
+                                 const KeyAt& key_at, hash_family& family,
+                                 const build_options& options) {
+            validate(options);
+            bucket_header& bucket = m_buckets[b];
+            if (n == 0) {
+                bucket = bucket_header();
+                return 0;
+            }
+
+            size_type reserved = bucket.offset == npos ? 0 : bucket.size;
+            bucket.size = std::max(reserved, table_size(n));
+
+            std::vector<size_type> elements(n);
+            std::iota(elements.begin(), elements.end(), 0);
+            slot_set taken;
+            size_type retries = do_perfect(bucket, elements.data(),
+                elements.data() + n, key_at, family, taken,
+                options.retry_budget, build_deadline(options));
+
+            if (bucket.size > reserved) {
+                bucket.offset = m_capacity;
+                m_capacity += bucket.size;
+            }
+            return retries;
+        }
+
+        /**
+         * @brief Number of first-level buckets.
+         */
+        size_type bucket_count() const {
+            return m_buckets.size();
+        }
+
+        /**
+         * @brief First-level bucket of a key.
+         */
+        template <typename K>
+        size_type bucket(const K& key) const {
+            return view().bucket_of(key);
+        }
+
+        /**
+         * @brief Slots of a bucket's second-level table, as [first, last).
+         */
+        std::pair<size_type, size_type> bucket_slots(size_type b) const {
+            const bucket_header& bucket = m_buckets[b];
+            if (bucket.offset == npos) return { 0, 0 };
+            return { bucket.offset, bucket.offset + bucket.size };
+        }
+
+        /**
+         * @brief Writes the engine, to be read back by view_type::load.
+         */
+        void save(binary_writer& writer) const {
+            writer.write(m_hash);
+            writer.write(uint64_t(m_capacity));
+            writer.write_array(m_buckets.data(), m_buckets.size());
+        }
+
+        /**
+         * @brief Heap memory held by the engine, in bytes.
+         */
+        size_type memory_usage() const {
+            return perfhash::memory_usage(m_buckets);
+        }
+
+        view_type view() const {
+            view_type view;
+            view.m_hash = m_hash;
+            view.m_buckets = m_buckets.data();
+            view.m_bucket_count = m_buckets.size();
+            view.m_capacity = m_capacity;
+            return view;
+        }
+
+        size_type capacity() const {
+            return m_capacity;
+        }
+
+        template <typename K>
+        size_type slot(const K& key) const {
+            return view().slot(key);
+        }
+
+        template <typename K>
+        size_type probe(const K& key) const {
+            return view().probe(key);
+        }
+
+        void probe_many(const key_type* keys, size_type n,
+                        size_type* out) const {
+            view().probe_many(keys, n, out);
+        }
+    private:
+        /**
+         * @brief First-level bucket header.
+         * 
+         * The bucket's second-level table holds `size` slots. Tables of a
+         * single slot leave `hash` unused.
+         */
+        struct bucket_header {
+            size_type offset = npos;
+            size_type size = 0;
+            hash_function hash;
+
+            template <typename K>
+            size_type slot(const K& key) const {
+                return size == 1 ? 0 : size_type(reduce(hash(key), size));
+            }
+        };
+
+        hash_function m_hash;
+        std::vector<bucket_header> m_buckets;
+        size_type m_capacity = 0;
+        double m_secondary_scale = 1.0;
+
+        /**
+         * @brief Number of second-level slots for a bucket of l keys.
+         */
+        size_type table_size(size_type l) const {
+            return std::max(l, size_type(std::ceil(
+                m_secondary_scale * double(l) * double(l))));
+        }
+
+        /**
+         * @brief Number of slots a table of l keys may grow to from `size`.
+         * 
+         * With 4 l^2 slots, a random function is collision-free with
+         * probability above 7/8, so a table that keeps failing at that size
+         * won't do any better larger.
+         */
+        static size_type max_table_size(size_type l, size_type size) {
+            return std::max(size, 4 * l * l);
+        }
+
+        /**
+         * @throw std::invalid_argument If a load factor or the retry budget
+         *  is not positive.
+         */
+        static void validate(const build_options& options) {
+            if (!(options.load_factor > 0) || !(options.secondary_scale > 0))
+                throw std::invalid_argument("Load factors must be positive");
+            if (options.retry_budget == 0)
+                throw std::invalid_argument("Retry budget must be positive");
+        }
+
+        /**
+         * @brief Finds a collision-free second-level function for a bucket.
+         * 
+         * Buckets of up to all_distinct_limit keys hash all their keys and
+         * compare every pair of slots; larger ones insert slots into `taken`
+         * until the first collision, then clear just what they inserted.
+         * Every `budget` failed functions, the bucket's table doubles, up to
+         * max_table_size().
+         * 
+         * @param taken Empty slot set, left empty.
+         * @return size_type Number of retries needed.
+         * 
+         * @throw build_error If the table can't grow any further, or the
+         *  deadline passes.
+         */
+        template <typename KeyAt>
+        size_type do_perfect(bucket_header& bucket,
+                             const size_type* first, const size_type* last,
+                             const KeyAt& key_at, hash_family& family,
+                             slot_set& taken, size_type budget,
+                             const build_deadline& deadline) const {
+            if (bucket.size == 1) return 0;
+
+            size_type l = size_type(last - first);
+            size_type limit = max_table_size(l, bucket.size);
+            size_type slots[all_distinct_limit];
+            taken.resize(bucket.size, l);
+            for (size_type retries = 0;; retries++) {
+                if (retries > 0 && retries % 64 == 0) deadline.check();
+                if (retries > 0 && retries % budget == 0) {
+                    if (bucket.size == limit)
+                        throw build_error("Could not build perfect hash");
+                    bucket.size = std::min(2 * bucket.size, limit);
+                    taken.resize(bucket.size, l);
+                }
+                bucket.hash = family.sample(hash_function::w);
+
+                if (l <= all_distinct_limit) {
+                    for (size_type i = 0; i < l; i++)
+                        slots[i] = bucket.slot(key_at(first[i]));
+                    if (all_distinct(slots, l)) return retries;
+                    continue;
+                }
+
+                auto e = first;
+                while (e != last && taken.insert(bucket.slot(key_at(*e)))) e++;
+                taken.clear();
+                if (e == last) return retries;
+            }
+        }
+    };
+
+    /**
+     * @brief FKS engine evaluating both levels from a single product.
+     * 
+     * For integer keys of up to 64 bits. A key is multiplied by a random odd
+     * constant; the high bits of the 64-bit product pick the first-level
+     * bucket, `reduce(product, bucket_count)`, and since the product is a
+     * bijection of the key, the bucket's second level rehashes the product
+     * itself, `reduce(seed * product, size)`. A lookup is one multiply, one
+     * load of a 24-byte bucket header, one more multiply and the slot load,
+     * where fks_engine evaluates two full multi-word functions on the key,
+     * the second one read from a larger header.
+     * 
+     * Tables are sized as in fks_engine.
+     * 
+     * @tparam Key type of integer key.
+     * @tparam HashFamily randomized universal hash family; only its
+     *  generator is used.
+     */
+    template <typename Key, typename HashFamily>
+    class fused_fks_engine {
+        static_assert(std::is_integral_v<Key> && sizeof(Key) <= 8,
+            "fused_fks_engine only hashes integers of up to 64 bits");
+
+        struct bucket_header;
+    public:
+        using key_type = Key;
+        using size_type = size_t;
+        using hash_family = HashFamily;
+
+        static constexpr size_type npos = size_type(-1);
+        static constexpr uint32_t tag = 0x534B4646; // "FFKS"
+        static constexpr bool incremental = true;
+
+        /**
+         * @brief Query side of the engine.
+         */
+        class view_type {
+        public:
+            size_type capacity() const {
+                return m_capacity;
+            }
+
+            /**
+             * @brief Slot of a key in the set.
+             * 
+             * @note If the key is not in the set, the result is unspecified.
+             */
+            size_type slot(const key_type& key) const {
+                uint64_t product = m_multiplier * uint64_t(key);
+                const bucket_header& bucket = m_buckets[bucket_of(product)];
+                return bucket.offset + bucket.slot(product);
+            }
+
+            /**
+             * @brief Slot a key would occupy, if it were in the set.
+             * 
+             * @return size_type A slot in [0, capacity()), or npos if the key
+             *  is certainly not in the set.
+             */
+            size_type probe(const key_type& key) const {
+                uint64_t product = m_multiplier * uint64_t(key);
+                const bucket_header& bucket = m_buckets[bucket_of(product)];
+                if (bucket.offset == npos) return npos;
+                return bucket.offset + bucket.slot(product);
+            }
+
+            /**
+             * @brief Probes a batch of keys.
+             * 
+             * @see fks_engine::view_type::probe_many
+             */
+            void probe_many(const key_type* keys, size_type n,
+                            size_type* out) const {
+                for (size_type i = 0; i < n; i++)
+                    out[i] = m_multiplier * uint64_t(keys[i]);
+                for (size_type i = 0; i < n; i++)
+                    prefetch(&m_buckets[bucket_of(out[i])]);
+                for (size_type i = 0; i < n; i++) {
+                    uint64_t product = out[i];
+                    const bucket_header& bucket = m_buckets[bucket_of(product)];
+                    out[i] = bucket.offset == npos
+                        ? npos : bucket.offset + bucket.slot(product);
+                }
+            }
+
+            /**
+             * @brief Reads an engine written by fused_fks_engine::save.
+             * 
+             * @throw std::runtime_error If the data is malformed.
+             */
+            static view_type load(binary_reader& reader) {
+                view_type view;
+                view.m_multiplier = reader.read<uint64_t>();
+                view.m_capacity = reader.read<uint64_t>();
+                view.m_buckets = reader.read_array<bucket_header>(
+                    view.m_bucket_count);
+                if (view.m_bucket_count == 0)
+                    throw std::runtime_error("Malformed perfect hash");
+
+                // Every table must lie within the slot array.
+                for (size_type i = 0; i < view.m_bucket_count; i++) {
+                    const bucket_header& bucket = view.m_buckets[i];
+                    if (bucket.offset == npos) continue;
+                    if (bucket.size == 0 || bucket.offset >= view.m_capacity
+                            || bucket.size > view.m_capacity - bucket.offset)
+                        throw std::runtime_error("Malformed perfect hash");
+                }
+                return view;
+            }
+        private:
+            friend class fused_fks_engine;
+
+            uint64_t m_multiplier = 1;
+            const bucket_header* m_buckets = nullptr;
+            size_type m_bucket_count = 0;
+            size_type m_capacity = 0;
+
+            size_type bucket_of(uint64_t product) const {
+                return size_type(reduce(product, m_bucket_count));
+            }
+        };
+
+        /**
+         * @brief Builds the engine for a set of keys.
+         * 
+         * @throw std::invalid_argument If a load factor or the retry budget
+         *  is not positive.
+         * @throw build_error If a bucket can't be placed within its budget,
+         *  or the build times out.
+         * @see fks_engine::build
+         */
+        template <typename KeyAt>
+        void build(size_type n, const KeyAt& key_at, hash_family& family,
+                   const build_options& options, build_statistics& stats) {
+            validate(options);
+            build_deadline deadline(options);
+
+            m_secondary_scale = options.secondary_scale;
+            m_multiplier = family.rng() | 1;
+            m_buckets.assign(std::max(size_type(1),
+                size_type(std::ceil(n / options.load_factor))),
+                bucket_header());
+            uint64_t salt = family.rng();
+            view_type params = view();
+
+            std::pmr::monotonic_buffer_resource arena(
+                options.scratch_resource());
+            std::pmr::vector<size_type> start(m_buckets.size() + 1, 0,
+                                              &arena);
+            std::pmr::vector<uint64_t> products(n, &arena);
+            {
+                scoped_timer timer(stats.partition_time);
+                std::pmr::vector<uint64_t> scattered(n, &arena);
+                parallel_for(options.threads, n, [&](size_type i) {
+                    scattered[i] = m_multiplier * uint64_t(key_at(i));
+                });
+
+                for (uint64_t p : scattered) start[params.bucket_of(p) + 1]++;
+                std::partial_sum(start.begin(), start.end(), start.begin());
+
+                std::pmr::vector<size_type> cursor(start.begin(),
+                                                   start.end() - 1, &arena);
+                for (uint64_t p : scattered)
+                    products[cursor[params.bucket_of(p)]++] = p;
+            }
+            deadline.check();
+
+            size_type largest = 0, longest = 0;
+            for (size_type i = 0; i < m_buckets.size(); i++) {
+                size_type l = start[i + 1] - start[i];
+                if (l == 0) continue;
+                m_buckets[i].size = table_size(l);
+                largest = std::max(largest, m_buckets[i].size);
+                longest = std::max(longest, l);
+            }
+
+            std::pmr::vector<size_type> retries(m_buckets.size(), 0, &arena);
+            {
+                scoped_timer timer(stats.search_time);
+                std::vector<slot_set> sets(worker_count(options.threads,
+                                                        m_buckets.size()));
+                for (slot_set& set : sets) set.resize(largest, longest);
+
+                parallel_for(options.threads, m_buckets.size(),
+                    [&](size_type i, unsigned worker) {
+                        if (start[i] == start[i + 1]) return;
+
+                        splitmix64 rng(mix64(salt + i));
+                        retries[i] = do_perfect(m_buckets[i],
+                            &products[start[i]], &products[start[i + 1]],
+                            rng, sets[worker], options.retry_budget,
+                            deadline);
+                    });
+            }
+
+            m_capacity = 0;
+            for (size_type i = 0; i < m_buckets.size(); i++) {
+                size_type l = start[i + 1] - start[i];
+                if (l == 0) continue;
+
+                auto& bucket = m_buckets[i];
+                bucket.offset = m_capacity;
+                m_capacity += bucket.size;
+                if (bucket.size > table_size(l)) stats.grown_buckets++;
+            }
+
+            stats.keys = n;
+            stats.buckets = m_buckets.size();
+            stats.slots = m_capacity;
+            stats.metadata = sizeof(m_multiplier)
+                + m_buckets.size() * sizeof(bucket_header);
+            for (size_type i = 0; i < m_buckets.size(); i++)
+                stats.add_bucket(start[i + 1] - start[i], retries[i]);
+        }
+
+        /**
+         * @brief Rebuilds a single bucket for a new set of keys.
+         * 
+         * @see fks_engine::rebuild_bucket
+         */
+        template <typename KeyAt>
+        size_type rebuild_bucket(size_type b, size_type n,
+                                 const KeyAt& key_at, hash_family& family,
+                                 const build_options& options) {
+            validate(options);
+            bucket_header& bucket = m_buckets[b];
+            if (n == 0) {
+                bucket = bucket_header();
+                return 0;
+            }
+
+            size_type reserved = bucket.offset == npos ? 0 : bucket.size;
+            bucket.size = std::max(reserved, table_size(n));
+
+            std::vector<uint64_t> products(n);
+            for (size_type i = 0; i < n; i++)
+                products[i] = m_multiplier * uint64_t(key_at(i));
+            slot_set taken;
+            size_type retries = do_perfect(bucket, products.data(),
+                products.data() + n, family.rng, taken,
+                options.retry_budget, build_deadline(options));
+
+            if (bucket.size > reserved) {
+                bucket.offset = m_capacity;
+                m_capacity += bucket.size;
+            }
+            return retries;
+        }
+
+        size_type bucket_count() const {
+            return m_buckets.size();
+        }
+
+        size_type bucket(const key_type& key) const {
+            return view().bucket_of(m_multiplier * uint64_t(key));
+        }
+
+        /**
+         * @brief Slots of a bucket's second-level table, as [first, last).
+         */
+        std::pair<size_type, size_type> bucket_slots(size_type b) const {
+            const bucket_header& bucket = m_buckets[b];
+            if (bucket.offset == npos) return { 0, 0 };
+            return { bucket.offset, bucket.offset + bucket.size };
+        }
+
+        /**
+         * @brief Writes the engine, to be read back by view_type::load.
+         */
+        void save(binary_writer& writer) const {
+            writer.write(m_multiplier);
+            writer.write(uint64_t(m_capacity));
+            writer.write_array(m_buckets.data(), m_buckets.size());
+        }
+
+        size_type memory_usage() const {
+            return perfhash::memory_usage(m_buckets);
+        }
+
+        view_type view() const {
+            view_type view;
+            view.m_multiplier = m_multiplier;
+            view.m_buckets = m_buckets.data();
+            view.m_bucket_count = m_buckets.size();
+            view.m_capacity = m_capacity;
+            return view;
+        }
+
+        size_type capacity() const {
+            return m_capacity;
+        }
+
+        size_type slot(const key_type& key) const {
+            return view().slot(key);
+        }
+
+        size_type probe(const key_type& key) const {
+            return view().probe(key);
+        }
+
+        void probe_many(const key_type* keys, size_type n,
+                        size_type* out) const {
+            view().probe_many(keys, n, out);
+        }
+    private:
+        /**
+         * @brief First-level bucket header.
+         * 
+         * The bucket's second-level table holds `size` slots, addressed by
+         * the high bits of `seed * product`.
+         */
+        struct bucket_header {
+            size_type offset = npos;
+            uint64_t seed = 0;
+            size_type size = 0;
+
+            size_type slot(uint64_t product) const {
+                return size_type(reduce(seed * product, size));
+            }
+        };
+
+        uint64_t m_multiplier = 1;
+        std::vector<bucket_header> m_buckets;
+        size_type m_capacity = 0;
+        double m_secondary_scale = 1.0;
+
+        size_type table_size(size_type l) const {
+            return std::max(l, size_type(std::ceil(
+                m_secondary_scale * double(l) * double(l))));
+        }
+
+        /**
+         * @see fks_engine::max_table_size
+         */
+        static size_type max_table_size(size_type l, size_type size) {
+            return std::max(size, 4 * l * l);
+        }
+
+        /**
+         * @see fks_engine::validate
+         */
+        static void validate(const build_options& options) {
+            if (!(options.load_factor > 0) || !(options.secondary_scale > 0))
+                throw std::invalid_argument("Load factors must be positive");
+            if (options.retry_budget == 0)
+                throw std::invalid_argument("Retry budget must be positive");
+        }
+
+        /**
+         * @brief Draws seeds until the bucket's products don't collide.
+         * 
+         * Checks for collisions and grows the table as
+         * fks_engine::do_perfect does.
+         * 
+         * @return size_type Number of retries needed.
+         * 
+         * @throw build_error If the table can't grow any further, or the
+         *  deadline passes.
+         */
+        template <typename RNG>
+        static size_type do_perfect(bucket_header& bucket,
+                                    const uint64_t* first, const uint64_t* last,
+                                    RNG& rng, slot_set& taken,
+                                    size_type budget,
+                                    const build_deadline& deadline) {
+            if (bucket.size == 1) return 0;
+
+            size_type l = size_type(last - first);
+            size_type limit = max_table_size(l, bucket.size);
+            size_type slots[all_distinct_limit];
+            taken.resize(bucket.size, l);
+            for (size_type retries = 0;; retries++) {
+                if (retries > 0 && retries % 64 == 0) deadline.check();
+                if (retries > 0 && retries % budget == 0) {
+                    if (bucket.size == limit)
+                        throw build_error("Could not build perfect hash");
+                    bucket.size = std::min(2 * bucket.size, limit);
+                    taken.resize(bucket.size, l);
+                }
+                bucket.seed = rng() | 1;
+
+                if (l <= all_distinct_limit) {
+                    for (size_type i = 0; i < l; i++)
+                        slots[i] = bucket.slot(first[i]);
+                    if (all_distinct(slots, l)) return retries;
+                    continue;
+                }
+
+                auto it = first;
+                while (it != last && taken.insert(bucket.slot(*it))) it++;
+                taken.clear();
+                if (it == last) return retries;
+            }
+        }
+    };
+
+    /**
+     * @brief Hash-and-displace construction engine.
+     * 
+     * A CHD/PTHash-style alternative to fks_engine. Every key is hashed once
+     * to a 64-bit fingerprint that selects one of about n / 4 buckets, and
+     * each bucket stores a 16-bit pilot that displaces all its keys onto free
+     * positions of a single table of about n / 0.97 slots. Pilots are found
+     * at build time by trial, largest buckets first.
+     * 
+     * The metadata costs about 4 bits per key, and a lookup needs a single
+     * probe into the slot array.
+     * 
+     * @tparam Key type of key to be hashed.
+     * @tparam HashFamily randomized universal hash family.
+     */
+    template <typename Key, typename HashFamily>
+    class chd_engine {
+    public:
+        using key_type = Key;
+        using size_type = size_t;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+        using pilot_type = uint16_t;
+
+        static constexpr size_type npos = size_type(-1);
+        static constexpr uint32_t tag = 0x444843; // "CHD"
+        static constexpr bool incremental = false;
+        static constexpr double load_factor = 0.97;
+        static constexpr double bucket_size = 4.0;
+
+        /**
+         * @brief Query side of the engine.
+         * 
+         * Refers to the engine's pilots without owning them, so it can just
+         * as well address an engine mapped in from a file.
+         */
+        class view_type {
+        public:
+            /**
+             * @brief Number of slots addressed by the engine.
+             */
+            size_type capacity() const {
+                return m_capacity;
+            }
+
+            /**
+             * @brief Slot of a key in the set.
+             * 
+             * @note If the key is not in the set, the result is unspecified.
+             */
+            template <typename K>
+            size_type slot(const K& key) const {
+                uint64_t f = mix64(m_hash(key));
+                return position(f, m_pilots[bucket(f)]);
+            }
+
+            /**
+             * @brief Slot a key would occupy, if it were in the set.
+             * 
+             * @return size_type A slot in [0, capacity()).
+             */
+            template <typename K>
+            size_type probe(const K& key) const {
+                return slot(key);
+            }
+
+            /**
+             * @brief Probes a batch of keys.
+             * 
+             * Same as calling probe() for every key, but all fingerprints are
+             * computed and their pilots prefetched before any pilot is read.
+             * 
+             * @param keys Keys to probe.
+             * @param n Number of keys.
+             * @param out Output slots, one per key.
+             */
+            void probe_many(const key_type* keys, size_type n,
+                            size_type* out) const {
+                static_assert(sizeof(size_type) >= sizeof(uint64_t),
+                    "fingerprints are staged in the output array");
+
+                for (size_type i = 0; i < n; i++)
+                    out[i] = mix64(m_hash(keys[i]));
+                for (size_type i = 0; i < n; i++)
+                    prefetch(&m_pilots[bucket(out[i])]);
+                for (size_type i = 0; i < n; i++)
+                    out[i] = position(out[i], m_pilots[bucket(out[i])]);
+            }
+
+            /**
+             * @brief Reads an engine written by chd_engine::save.
+             * 
+             * @throw std::runtime_error If the data is malformed.
+             */
+            static view_type load(binary_reader& reader) {
+                view_type view;
+                view.m_hash = reader.read<hash_function>();
+                view.m_capacity = reader.read<uint64_t>();
+                view.m_dense_buckets = reader.read<uint64_t>();
+                view.m_pilots = reader.read_array<pilot_type>(
+                    view.m_bucket_count);
+                if (view.m_dense_buckets >= view.m_bucket_count
+                        || view.m_capacity == 0)
+                    throw std::runtime_error("Malformed perfect hash");
+                return view;
+            }
+        private:
+            friend class chd_engine;
+
+            static constexpr uint64_t dense_threshold =
+                uint64_t(0.6 * 0x1p64);
+
+            hash_function m_hash;
+            const pilot_type* m_pilots = nullptr;
+            size_type m_capacity = 0;
+            size_type m_bucket_count = 0;
+            size_type m_dense_buckets = 0;
+
+            /**
+             * @brief Bucket of a fingerprint.
+             * 
+             * 60% of the keys go to the first 30% of the buckets, which are
+             * thus larger and get placed while the table is still mostly
+             * empty.
+             */
+            size_type bucket(uint64_t f) const {
+                if (f < dense_threshold) return reduce(f, m_dense_buckets);
+                return m_dense_buckets
+                    + reduce(mix64(f), m_bucket_count - m_dense_buckets);
+            }
+
+            size_type position(uint64_t f, pilot_type pilot) const {
+                return reduce(mix64(f ^ (pilot * 0x9E3779B97F4A7C15ULL)),
+                              m_capacity);
+            }
+        };
+
+        /**
+         * @brief Builds the engine for a set of keys.
+         * 
+         * @tparam KeyAt callable returning the i-th key of the set.
+         * @param n Number of keys in the set.
+         * @param key_at Accessor for the keys.
+         * @param family Hash family to draw functions from.
+         * @param options Build options. Only fingerprinting is parallel;
+         *  displacement is inherently sequential.
+         * @param stats Statistics to fill in.
+         * 
+         * @throw build_error If no displacement could be found after
+         *  repeatedly drawing new functions (e.g. the set has duplicates), or
+         *  the build times out.
+         */
+        template <typename KeyAt>
+        void build(size_type n, const KeyAt& key_at, hash_family& family,
+                   const build_options& options, build_statistics& stats) {
+            m_capacity = size_type(n / load_factor) + 1;
+            m_pilots.assign(size_type(n / bucket_size) + 2, 0);
+            m_dense_buckets = size_type(m_pilots.size() * 0.3) + 1;
+
+            build_deadline deadline(options);
+            std::pmr::vector<uint64_t> fingerprints(n,
+                options.scratch_resource());
+            for (unsigned attempt = 0; attempt < max_attempts; attempt++) {
+                deadline.check();
+                m_hash = family.sample(hash_function::w);
+                {
+                    scoped_timer timer(stats.partition_time);
+                    parallel_for(options.threads, n, [&](size_type i) {
+                        fingerprints[i] = mix64(m_hash(key_at(i)));
+                    });
+                }
+                if (search(fingerprints, options.scratch_resource(), deadline,
+                           stats)) {
+                    stats.keys = n;
+                    stats.buckets = m_pilots.size();
+                    stats.slots = m_capacity;
+                    stats.metadata = sizeof(m_hash)
+                        + m_pilots.size() * sizeof(pilot_type);
+                    stats.restarts = attempt;
+                    return;
+                }
+            }
+            throw build_error("Could not build perfect hash");
+        }
+
+        /**
+         * @brief Writes the engine, to be read back by view_type::load.
+         */
+        void save(binary_writer& writer) const {
+            writer.write(m_hash);
+            writer.write(uint64_t(m_capacity));
+            writer.write(uint64_t(m_dense_buckets));
+            writer.write_array(m_pilots.data(), m_pilots.size());
+        }
+
+        /**
+         * @brief Heap memory held by the engine, in bytes.
+         */
+        size_type memory_usage() const {
+            return perfhash::memory_usage(m_pilots);
+        }
+
+        view_type view() const {
+            view_type view;
+            view.m_hash = m_hash;
+            view.m_pilots = m_pilots.data();
+            view.m_capacity = m_capacity;
+            view.m_bucket_count = m_pilots.size();
+            view.m_dense_buckets = m_dense_buckets;
+            return view;
+        }
+
+        size_type capacity() const {
+            return m_capacity;
+        }
+
+        template <typename K>
+        size_type slot(const K& key) const {
+            return view().slot(key);
+        }
+
+        template <typename K>
+        size_type probe(const K& key) const {
+            return view().probe(key);
+        }
+
+        void probe_many(const key_type* keys, size_type n,
+                        size_type* out) const {
+            view().probe_many(keys, n, out);
+        }
+    private:
+        static constexpr unsigned max_attempts = 64;
+
+        hash_function m_hash;
+        std::vector<pilot_type> m_pilots;
+        size_type m_capacity = 0;
+        size_type m_dense_buckets = 0;
+
+        /**
+         * @brief Searches pilots for every bucket, with the current function.
+         * 
+         * @param scratch Resource for the attempt's temporary buffers.
+         * @param deadline Deadline, checked every few buckets.
+         * @return bool Whether every bucket could be placed.
+         */
+        bool search(const std::pmr::vector<uint64_t>& fingerprints,
+                    std::pmr::memory_resource* scratch,
+                    const build_deadline& deadline,
+                    build_statistics& stats) {
+            scoped_timer timer(stats.search_time);
+            size_type n = fingerprints.size();
+            size_type bucket_count = m_pilots.size();
+            std::fill(m_pilots.begin(), m_pilots.end(), 0);
+            view_type params = view();
+
+            std::pmr::monotonic_buffer_resource arena(scratch);
+            std::pmr::vector<size_type> start(bucket_count + 1, 0, &arena);
+            for (uint64_t f : fingerprints) start[params.bucket(f) + 1]++;
+            std::partial_sum(start.begin(), start.end(), start.begin());
+
+            std::pmr::vector<size_type> cursor(start.begin(), start.end() - 1,
+                                               &arena);
+            std::pmr::vector<uint64_t> sorted(n, &arena);
+            for (uint64_t f : fingerprints)
+                sorted[cursor[params.bucket(f)]++] = f;
+
+            std::pmr::vector<size_type> order(bucket_count, &arena);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(),
+                [&](size_type a, size_type b) {
+                    return start[a + 1] - start[a] > start[b + 1] - start[b];
+                });
+
+            std::pmr::vector<bool> taken(m_capacity, false, &arena);
+            for (size_type i = 0; i < bucket_count; i++) {
+                size_type b = order[i];
+                auto first = sorted.begin() + start[b];
+                auto last = sorted.begin() + start[b + 1];
+                if (first == last) break;
+                if (i % 1024 == 1023) deadline.check();
+
+                std::sort(first, last);
+                if (std::adjacent_find(first, last) != last) return false;
+                if (!displace(params, b, first, last, taken)) return false;
+            }
+
+            stats.bucket_sizes.clear();
+            stats.retries.clear();
+            stats.total_retries = stats.max_retries = 0;
+            for (size_type b = 0; b < bucket_count; b++)
+                stats.add_bucket(start[b + 1] - start[b], m_pilots[b]);
+            return true;
+        }
+
+        template <typename Iterator>
+        bool displace(const view_type& params, size_type b,
+                      Iterator first, Iterator last,
+                      std::pmr::vector<bool>& taken) {
+            for (uint64_t pilot = 0; pilot <= pilot_type(-1); pilot++) {
+                auto it = first;
+                for (; it != last; it++) {
+                    size_type h = params.position(*it, pilot_type(pilot));
+                    if (taken[h]) break;
+                    taken[h] = true;
+                }
+                if (it == last) {
+                    m_pilots[b] = pilot_type(pilot);
+                    return true;
+                }
+                for (auto undo = first; undo != it; undo++)
+                    taken[params.position(*undo, pilot_type(pilot))] = false;
+            }
+            return false;
+        }
+    };
+
+    /**
+     * @brief Slot of a perfect_hash_map.
+     * 
+     * Holds what the key storage policy keeps of a key (`first`) and room
+     * for a value (`second`). The value is only constructed while the slot
+     * holds an element, so values need not be default constructible; the
+     * map tracks which slots do. Copying a slot is not possible, since it
+     * can't tell whether it holds a value.
+     * 
+     * @tparam Tag what is kept of the key, or void if nothing is.
+     * @tparam Value type of value stored in the slot.
+     */
+    template <typename Tag, typename Value>
+    struct map_slot {
+        Tag first;
+        union { Value second; };
+
+        explicit map_slot(const Tag& tag) : first(tag) {}
+        map_slot(const map_slot&) = delete;
+        map_slot& operator=(const map_slot&) = delete;
+        ~map_slot() {}
+
+        /**
+         * @brief Access for structured bindings.
+         */
+        template <size_t I>
+        auto& get() {
+            if constexpr (I == 0) return first;
+            else return second;
+        }
+
+        template <size_t I>
+        const auto& get() const {
+            if constexpr (I == 0) return first;
+            else return second;
+        }
+    };
+
+    template <typename Value>
+    struct map_slot<void, Value> {
+        union { Value second; };
+
+        map_slot() {}
+        map_slot(const map_slot&) = delete;
+        map_slot& operator=(const map_slot&) = delete;
+        ~map_slot() {}
+    };
+
+    /**
+     * @brief Key storage policy keeping a full copy of each key in its slot.
+     * 
+     * Lookups compare against the stored key, so queries for keys that are
+     * not in the map are always detected.
+     * 
+     * Slots with no element hold a copy of some element's key, so keys need
+     * only be copy constructible. Empty maps have no slots at all.
+     */
+    struct stored_keys {
+        template <typename Key, typename Value, typename HashFamily>
+        class policy {
+        public:
+            using slot_type = map_slot<Key, Value>;
+
+            static constexpr uint32_t tag = 0;
+            static constexpr bool stores_keys = true;
+
+            void sample(HashFamily&) {}
+
+            /**
+             * @brief Constructs a slot holding no element.
+             * 
+             * Its key is a copy of the key of an element stored elsewhere,
+             * which no query that probes this slot can be equal to.
+             * 
+             * @param resident Key of an element in the map, never nullptr.
+             */
+            void construct(slot_type* slot, const Key* resident) const {
+                assert(resident != nullptr);
+                new (slot) slot_type(*resident);
+            }
+
+            /**
+             * @brief Stores an element into a slot holding no value,
+             *  moving from it if it is an rvalue.
+             */
+            template <typename Element>
+            void place(slot_type& slot, Element&& element) const {
+                slot.first = std::forward<Element>(element).first;
+                new (&slot.second)
+                    Value(std::forward<Element>(element).second);
+            }
+
+            /**
+             * @brief Marks a slot whose value was destroyed as holding no
+             *  element.
+             * 
+             * @param resident Key of an element in the map.
+             */
+            void vacate(slot_type& slot, const Key& resident) const {
+                slot.first = resident;
+            }
+
+            template <typename K>
+            bool matches(const slot_type& slot, const K& key) const {
+                return slot.first == key;
+            }
+
+            static Value& value(slot_type& slot) {
+                return slot.second;
+            }
+
+            static const Value& value(const slot_type& slot) {
+                return slot.second;
+            }
+
+            void save(binary_writer&) const {}
+
+            static policy load(binary_reader&) {
+                return policy();
+            }
+        };
+    };
+
+    /**
+     * @brief Key storage policy keeping a small fingerprint of each key.
+     * 
+     * Slots hold a hash of the key, drawn independently from the engine's
+     * functions, instead of the key itself. Queries for keys that are not in
+     * the map are detected unless their fingerprint happens to match, which
+     * happens with probability about 2^-(8 * sizeof(Fingerprint)).
+     * 
+     * @tparam Fingerprint unsigned integer type of the fingerprint.
+     */
+    template <typename Fingerprint = uint8_t>
+    struct fingerprint_keys {
+        static_assert(std::is_unsigned_v<Fingerprint>,
+            "fingerprints must be unsigned integers");
+
+        template <typename Key, typename Value, typename HashFamily>
+        class policy {
+        public:
+            using hash_function = typename HashFamily::hash_function;
+            using slot_type = map_slot<Fingerprint, Value>;
+
+            static constexpr uint32_t tag = 0x4650 + sizeof(Fingerprint);
+            static constexpr bool stores_keys = false;
+
+            void sample(HashFamily& family) {
+                m_hash = family.sample(8 * sizeof(Fingerprint));
+            }
+
+            /**
+             * @brief Constructs a slot holding no element.
+             * 
+             * Its fingerprint is zero, which queries probing the slot match
+             * no more often than any other fingerprint.
+             */
+            void construct(slot_type* slot, const Key*) const {
+                new (slot) slot_type(Fingerprint(0));
+            }
+
+            template <typename Element>
+            void place(slot_type& slot, Element&& element) const {
+                slot.first = Fingerprint(m_hash(element.first));
+                new (&slot.second)
+                    Value(std::forward<Element>(element).second);
+            }
+
+            void vacate(slot_type& slot, const Key&) const {
+                slot.first = Fingerprint(0);
+            }
+
+            template <typename K>
+            bool matches(const slot_type& slot, const K& key) const {
+                return slot.first == Fingerprint(m_hash(key));
+            }
+
+            static Value& value(slot_type& slot) {
+                return slot.second;
+            }
+
+            static const Value& value(const slot_type& slot) {
+                return slot.second;
+            }
+
+            void save(binary_writer& writer) const {
+                writer.write(m_hash);
+            }
+
+            static policy load(binary_reader& reader) {
+                policy result;
+                result.m_hash = reader.read<hash_function>();
+                return result;
+            }
+        private:
+            hash_function m_hash;
+        };
+    };
+
+    /**
+     * @brief Key storage policy keeping nothing but the values.
+     * 
+     * For maps only ever queried with keys known to be in them. Queries for
+     * other keys return an arbitrary value instead of failing, unless the
+     * engine itself can tell they are missing or they probe an empty slot.
+     */
+    struct no_keys {
+        template <typename Key, typename Value, typename HashFamily>
+        class policy {
+        public:
+            using slot_type = map_slot<void, Value>;
+
+            static constexpr uint32_t tag = 0x4E4B;
+            static constexpr bool stores_keys = false;
+
+            void sample(HashFamily&) {}
+
+            void construct(slot_type* slot, const Key*) const {
+                new (slot) slot_type();
+            }
+
+            template <typename Element>
+            void place(slot_type& slot, Element&& element) const {
+                new (&slot.second)
+                    Value(std::forward<Element>(element).second);
+            }
+
+            void vacate(slot_type&, const Key&) const {}
+
+            template <typename K>
+            bool matches(const slot_type&, const K&) const {
+                return true;
+            }
+
+            static Value& value(slot_type& slot) {
+                return slot.second;
+            }
+
+            static const Value& value(const slot_type& slot) {
+                return slot.second;
+            }
+
+            void save(binary_writer&) const {}
+
+            static policy load(binary_reader&) {
+                return policy();
+            }
+        };
+    };
+
+    /**
+     * @brief Instrumentation policy recording nothing.
+     * 
+     * The default for perfect_hash_map: lookups compile exactly as if there
+     * were no instrumentation at all.
+     */
+    struct no_instrumentation {
+        static constexpr bool enabled = false;
+    };
+
+    /**
+     * @brief Lookup costs collected by a lookup_profiler.
+     * 
+     * Only sampled lookups are counted; multiply by `sample_period` to
+     * estimate totals.
+     */
+    struct lookup_profile {
+        /**
+         * @brief One in how many lookup calls is sampled.
+         */
+        size_t sample_period = 0;
+
+        /**
+         * @brief Number of sampled calls. A batched call (find_many) counts
+         *  once, however many keys it looks up.
+         */
+        size_t samples = 0;
+
+        /**
+         * @brief Keys looked up by sampled calls.
+         */
+        size_t lookups = 0;
+
+        /**
+         * @brief Sampled keys found in the container.
+         */
+        size_t hits = 0;
+
+        /**
+         * @brief Histogram of latencies per key, in nanoseconds: bin k
+         *  counts samples taking t ns per key with `log2(t) == k` (see
+         *  build_statistics::retries).
+         */
+        std::vector<size_t> latency;
+
+        /**
+         * @brief Wall time of all sampled calls.
+         */
+        std::chrono::duration<double> total_latency{};
+
+        /**
+         * @brief Whether the hardware counters below were available.
+         * 
+         * They are read through perf_event on Linux, and need the
+         * kernel to allow unprivileged user-space counting.
+         */
+        bool hardware_counters = false;
+
+        /**
+         * @brief Cache misses (last level) during sampled calls.
+         */
+        uint64_t cache_misses = 0;
+
+        /**
+         * @brief Data TLB read misses during sampled calls.
+         */
+        uint64_t tlb_misses = 0;
+
+        size_t misses() const {
+            return lookups - hits;
+        }
+
+        /**
+         * @brief Mean latency per sampled key, in nanoseconds.
+         */
+        double mean_latency() const {
+            return lookups == 0 ? 0 : total_latency.count() * 1e9 / lookups;
+        }
+    };
+
+    /**
+     * @brief Instrumentation policy sampling lookups.
+     * 
+     * One in every sample_period() calls to at(), find(), contains() or
+     * find_many() is timed and, where available, bracketed with readings of
+     * the calling thread's cache-miss and TLB-miss counters. Other calls
+     * only pay for a thread-local countdown. operator[] is never sampled.
+     * 
+     * Samples are recorded with relaxed atomics, so concurrent readers may
+     * look up and take profiles at any time. The countdown is shared by
+     * every profiler a thread uses.
+     * 
+     * @note Counter readings are system calls, which interfere with the
+     *  lookups they measure: figures are best compared with each other
+     *  rather than taken as absolutes.
+     */
+    class lookup_profiler {
+    public:
+        static constexpr bool enabled = true;
+
+        /**
+         * @brief State of a sampled call, from before it started.
+         */
+        struct measurement {
+            std::chrono::steady_clock::time_point start;
+            uint64_t counters[2] = {};
+            bool counted = false;
+        };
+
+        lookup_profiler() = default;
+
+        lookup_profiler(const lookup_profiler& other) noexcept {
+            *this = other;
+        }
+
+        /**
+         * @brief Same as copying: atomics can't be moved from.
+         */
+        lookup_profiler(lookup_profiler&& other) noexcept {
+            *this = other;
+        }
+
+        /**
+         * @brief Copies the period and the samples collected so far.
+         */
+        lookup_profiler& operator=(const lookup_profiler& other) noexcept {
+            m_period = other.m_period;
+            for (size_t i = 0; i < count_fields; i++)
+                m_counts[i] = other.m_counts[i].load(std::memory_order_relaxed);
+            for (size_t i = 0; i < latency_bins; i++)
+                m_latency[i] = other.m_latency[i].load(
+                    std::memory_order_relaxed);
+            return *this;
+        }
+
+        lookup_profiler& operator=(lookup_profiler&& other) noexcept {
+            return *this = other;
+        }
+
+        size_t sample_period() const {
+            return m_period;
+        }
+
+        /**
+         * @brief Sets one in how many calls is sampled.
+         * 
+         * @note Not to be called while other threads look up.
+         * @throw std::invalid_argument If `period` is zero.
+         */
+        void set_sample_period(size_t period) {
+            if (period == 0)
+                throw std::invalid_argument("Sample period must be positive");
+            m_period = period;
+        }
+
+        /**
+         * @brief Whether to measure the current call.
+         */
+        bool sample() const noexcept {
+            thread_local size_t countdown = 0;
+            if (countdown != 0) {
+                countdown--;
+                return false;
+            }
+            countdown = m_period - 1;
+            return true;
+        }
+
+        measurement begin() const noexcept {
+            measurement m;
+            m.counted = read_counters(m.counters);
+            m.start = std::chrono::steady_clock::now();
+            return m;
+        }
+
+        /**
+         * @brief Records a sampled call.
+         * 
+         * @param m What begin() returned before the call.
+         * @param lookups Number of keys the call looked up.
+         * @param hits Number of those found.
+         */
+        void end(const measurement& m, size_t lookups,
+                 size_t hits) const noexcept {
+            auto elapsed = std::chrono::steady_clock::now() - m.start;
+            uint64_t counters[2];
+            bool counted = m.counted && read_counters(counters);
+
+            uint64_t ns = uint64_t(std::chrono::duration_cast<
+                std::chrono::nanoseconds>(elapsed).count());
+            add(samples, 1);
+            add(keys, lookups);
+            add(found, hits);
+            add(elapsed_ns, ns);
+            if (counted) {
+                add(counted_samples, 1);
+                add(cache_misses, counters[0] - m.counters[0]);
+                add(tlb_misses, counters[1] - m.counters[1]);
+            }
+            m_latency[log2(ns / std::max(lookups, size_t(1)))].fetch_add(
+                1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Samples collected so far.
+         */
+        lookup_profile profile() const {
+            lookup_profile profile;
+            profile.sample_period = m_period;
+            profile.samples = get(samples);
+            profile.lookups = get(keys);
+            profile.hits = get(found);
+            profile.total_latency = std::chrono::nanoseconds(get(elapsed_ns));
+            profile.hardware_counters = get(counted_samples) != 0;
+            profile.cache_misses = get(cache_misses);
+            profile.tlb_misses = get(tlb_misses);
+            for (size_t i = 0; i < latency_bins; i++) {
+                size_t count = m_latency[i].load(std::memory_order_relaxed);
+                if (count == 0) continue;
+                profile.latency.resize(i + 1);
+                profile.latency[i] = count;
+            }
+            return profile;
+        }
+
+        /**
+         * @brief Drops the samples collected so far.
+         */
+        void reset() {
+            for (auto& count : m_counts) count = 0;
+            for (auto& count : m_latency) count = 0;
+        }
+    private:
+        enum field {
+            samples, keys, found, elapsed_ns,
+            counted_samples, cache_misses, tlb_misses, count_fields
+        };
+
+        static constexpr size_t latency_bins = 65;
+
+        size_t m_period = 1024;
+        mutable std::atomic<uint64_t> m_counts[count_fields] = {};
+        mutable std::atomic<uint64_t> m_latency[latency_bins] = {};
+
+        void add(field f, uint64_t value) const noexcept {
+            m_counts[f].fetch_add(value, std::memory_order_relaxed);
+        }
+
+        uint64_t get(field f) const noexcept {
+            return m_counts[f].load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Reads the calling thread's cache-miss and TLB-miss
+         *  counters, opening them on first use.
+         * 
+         * @return bool Whether the counters are available.
+         */
+        static bool read_counters(uint64_t (&values)[2]) noexcept {
+#if defined(__linux__)
+            struct counter_group {
+                int leader = -1;
+                int member = -1;
+
+                counter_group() {
+                    leader = open(PERF_TYPE_HARDWARE,
+                                  PERF_COUNT_HW_CACHE_MISSES, -1);
+                    if (leader < 0) return;
+                    member = open(PERF_TYPE_HW_CACHE,
+                        PERF_COUNT_HW_CACHE_DTLB
+                            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+                        leader);
+                    if (member < 0) {
+                        ::close(leader);
+                        leader = -1;
+                    }
+                }
+
+                ~counter_group() {
+                    if (member >= 0) ::close(member);
+                    if (leader >= 0) ::close(leader);
+                }
+
+                static int open(uint32_t type, uint64_t config, int group) {
+                    perf_event_attr attr;
+                    std::memset(&attr, 0, sizeof(attr));
+                    attr.size = sizeof(attr);
+                    attr.type = type;
+                    attr.config = config;
+                    attr.read_format = PERF_FORMAT_GROUP;
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                    return int(::syscall(SYS_perf_event_open, &attr, 0, -1,
+                                         group, 0));
+                }
+            };
+
+            thread_local counter_group group;
+            if (group.leader < 0) return false;
+
+            uint64_t buffer[3];
+            if (::read(group.leader, buffer, sizeof(buffer))
+                    != ssize_t(sizeof(buffer)))
+                return false;
+            values[0] = buffer[1];
+            values[1] = buffer[2];
+            return true;
+#else
+            (void) values;
+            return false;
+#endif
+        }
+    };
+
+    /**
+     * @brief Base class deleting the copy operations of classes that can't
+     *  be copied.
+     * 
+     * A class whose copy operations are written out is copy constructible
+     * as far as type traits can tell, even if instantiating them would
+     * fail. Deriving from copyable_if<false>, and declaring those operations
+     * for copyable_if<Copyable>::copy_source, makes the implicit, deleted
+     * ones take their place.
+     */
+    template <bool Copyable>
+    struct copyable_if {
+        template <typename T>
+        using copy_source = T;
+    };
+
+    template <>
+    struct copyable_if<false> {
+        template <typename T>
+        using copy_source = copyable_if;
+
+        copyable_if() = default;
+        copyable_if(const copyable_if&) = delete;
+        copyable_if(copyable_if&&) = default;
+        copyable_if& operator=(const copyable_if&) = delete;
+        copyable_if& operator=(copyable_if&&) = default;
+    };
+
+    /**
+     * @brief Base class holding a policy object, with no room taken if the
+     *  policy is empty.
+     */
+    template <typename Policy, bool = std::is_empty_v<Policy>>
+    class policy_holder {
+    public:
+        Policy& policy() noexcept {
+            return m_policy;
+        }
+
+        const Policy& policy() const noexcept {
+            return m_policy;
+        }
+    private:
+        Policy m_policy;
+    };
+
+    template <typename Policy>
+    class policy_holder<Policy, true> : private Policy {
+    public:
+        Policy& policy() noexcept {
+            return *this;
+        }
+
+        const Policy& policy() const noexcept {
+            return *this;
+        }
+    };
+
+    /**
+     * @brief Static collision-free hash map.
+     * 
+     * Elements live in a single contiguous slot array, addressed by a
+     * construction engine that maps every key to a distinct slot. By default
+     * the engine is FKS two-tiered hashing (fks_engine); chd_engine trades a
+     * slower build for much less memory.
+     * 
+     * Values are constructed in place, straight from the elements given, so
+     * they need not be default constructible or copyable: a map of
+     * move-only values can be built from a container of them given as an
+     * rvalue. Keys need only be copy constructible.
+     * 
+     * @tparam Key type of key used in the map.
+     * @tparam Value type of value stored in the map.
+     * @tparam HashFamily randomized universal hash family.
+     * @tparam Allocator allocator for the slot array and index, rebound to
+     *  their element types.
+     * @tparam Engine construction engine.
+     * @tparam KeyStorage what slots keep of each key: stored_keys,
+     *  fingerprint_keys or no_keys.
+     * @tparam Instrumentation lookup instrumentation: no_instrumentation or
+     *  lookup_profiler.
+     */
+    template <
+        typename Key,
+        typename Value,
+        typename HashFamily = ru_hash_family<Key>,
+        typename Allocator = std::allocator<std::pair<Key, Value>>,
+        template <typename, typename> typename Engine = fks_engine,
+        typename KeyStorage = stored_keys,
+        typename Instrumentation = no_instrumentation,
+        std::enable_if_t<std::is_copy_constructible_v<Key>, int> = 0
+    > class perfect_hash_map
+        : private copyable_if<std::is_copy_constructible_v<Value>>,
+          private policy_holder<Instrumentation> {
+        using copy_source = typename copyable_if<
+            std::is_copy_constructible_v<Value>>::template copy_source<
+                perfect_hash_map>;
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using value_type = std::pair<key_type, mapped_type>;
+        using size_type = size_t;
+        using allocator_type = Allocator;
+        using reference = Value&;
+        using const_reference = const Value&;
+        using pointer = typename std::allocator_traits<allocator_type>::pointer;
+        using const_pointer = typename std::allocator_traits<allocator_type>::const_pointer;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+        using engine_type = Engine<key_type, hash_family>;
+        using key_storage_policy = typename KeyStorage::template policy<
+            key_type, mapped_type, hash_family>;
+        using slot_type = typename key_storage_policy::slot_type;
+        using instrumentation_type = Instrumentation;
+
+        /**
+         * @brief Iterator over the elements of the map.
+         * 
+         * Walks the index of populated slots.
+         */
+        template <typename Slot>
+        class basic_iterator {
+        public:
+            static_assert(key_storage_policy::stores_keys,
+                "only maps that store their keys can be iterated");
+
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::remove_const_t<Slot>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = Slot*;
+            using reference = Slot&;
+
+            basic_iterator() = default;
+
+            /**
+             * @brief Conversion from iterator to const_iterator.
+             */
+            template <typename Other, typename = std::enable_if_t<
+                std::is_convertible_v<Other*, Slot*>>>
+            basic_iterator(const basic_iterator<Other>& other)
+                : m_slots(other.m_slots), m_index(other.m_index) {}
+
+            reference operator*() const {
+                return m_slots[*m_index];
+            }
+
+            pointer operator->() const {
+                return &m_slots[*m_index];
+            }
+
+            basic_iterator& operator++() {
+                m_index++;
+                return *this;
+            }
+
+            basic_iterator operator++(int) {
+                basic_iterator old = *this;
+                m_index++;
+                return old;
+            }
+
+            bool operator==(const basic_iterator& other) const {
+                return m_index == other.m_index;
+            }
+
+            bool operator!=(const basic_iterator& other) const {
+                return m_index != other.m_index;
+            }
+        private:
+            friend class perfect_hash_map;
+
+            template <typename>
+            friend class basic_iterator;
+
+            Slot* m_slots = nullptr;
+            const size_type* m_index = nullptr;
+
+            basic_iterator(Slot* slots, const size_type* index)
+                : m_slots(slots), m_index(index) {}
+        };
+
+        using iterator = basic_iterator<slot_type>;
+        using const_iterator = basic_iterator<const slot_type>;
+
+        perfect_hash_map() = delete;
+
+        /**
+         * @brief Copy constructor.
+         * 
+         * Only available if values are copy constructible.
+         */
+        perfect_hash_map(const copy_source& other)
+            : policy_holder<Instrumentation>(other),
+              m_engine(other.m_engine),
+              m_key_storage(other.m_key_storage),
+              m_slots(other.m_slots, std::allocator_traits<
+                  slot_allocator_type>::select_on_container_copy_construction(
+                      other.m_slots.get_allocator())),
+              m_index(other.m_index),
+              m_position(other.m_position),
+              m_size(other.m_size),
+              m_stats(other.m_stats),
+              m_options(other.m_options),
+              m_resident(other.m_resident) {}
+
+        perfect_hash_map(perfect_hash_map&&) = default;
+
+        /**
+         * @brief Range constructor.
+         * 
+         * Constructs a container with as many elements as the range
+         * [first,last), with each element constructed from its corresponding
+         * element in that range.
+         * 
+         * @tparam Iterator STL iterator for a collection type.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param allocator Allocator object.
+         */
+        template <typename Iterator>
+        perfect_hash_map(Iterator first, Iterator last,
+                         const allocator_type& allocator = allocator_type())
+            : perfect_hash_map(first, last, build_options(), allocator) {}
+
+        /**
+         * @brief Range constructor with build options.
+         * 
+         * @tparam Iterator STL iterator for a collection type.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param options Build options (e.g. number of threads).
+         * @param allocator Allocator object.
+         * 
+         * @throw build_error If the keys can't be placed within the bounds
+         *  set by `options`, or the build times out.
+         */
+        template <typename Iterator>
+        perfect_hash_map(Iterator first, Iterator last,
+                         const build_options& options,
+                         const allocator_type& allocator = allocator_type())
+            : m_slots(slot_allocator_type(allocator)), m_index(allocator),
+              m_position(allocator) {
+            hash_family family = seeded_family<hash_family>(options.seed);
+            populate(first, last, family, options);
+        }
+
+        /**
+         * @brief Range constructor with an explicit seed.
+         * 
+         * Reads no random device, and builds the same container every time
+         * it is given the same elements and seed.
+         * 
+         * @tparam Iterator STL iterator for a collection type.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param seed Seed for construction (see build_options::seed).
+         * @param allocator Allocator object.
+         */
+        template <typename Iterator>
+        perfect_hash_map(Iterator first, Iterator last, uint64_t seed,
+                         const allocator_type& allocator = allocator_type())
+            : m_slots(slot_allocator_type(allocator)), m_index(allocator),
+              m_position(allocator) {
+            hash_family family = seeded_family<hash_family>(seed);
+            populate(first, last, family, build_options());
+        }
+
+        /**
+         * @brief Range constructor consuming a container.
+         * 
+         * Same as the range constructor, except elements are moved out of
+         * the container, each straight into its slot.
+         * 
+         * @tparam Container container of key-value pairs, given as an
+         *  rvalue.
+         * @param elements The container, left with moved-from elements.
+         * @param options Build options (e.g. number of threads).
+         * @param allocator Allocator object.
+         */
+        template <typename Container,
+                  typename = decltype(std::begin(std::declval<Container&>())),
+                  std::enable_if_t<!std::is_lvalue_reference_v<Container>
+                    && !std::is_same_v<std::decay_t<Container>,
+                                       perfect_hash_map>, int> = 0>
+        explicit perfect_hash_map(Container&& elements,
+                                  const build_options& options = build_options(),
+                                  const allocator_type& allocator = allocator_type())
+            : perfect_hash_map(std::make_move_iterator(std::begin(elements)),
+                               std::make_move_iterator(std::end(elements)),
+                               options, allocator) {}
+
+        /**
+         * @brief Initializer list constructor.
+         * 
+         * @param values An initializer_list object.
+         * @param allocator Allocator object.
+         */
+        perfect_hash_map(const std::initializer_list<value_type>& values,
+                         const allocator_type& allocator = allocator_type())
+            : perfect_hash_map(values.begin(), values.end(), allocator) {}
+        
+        /**
+         * @brief Copy assignment operator.
+         * 
+         * Only available if values are copy constructible.
+         * 
+         * @param other An object of the same type.
+         * @return perfect_hash_map& *this.
+         */
+        perfect_hash_map& operator=(const copy_source& other) {
+            if (this != &other) *this = perfect_hash_map(other);
+            return *this;
+        }
+        
+        /**
+         * @brief Move assignment operator.
+         * 
+         * @param other An object of the same type.
+         * @return perfect_hash_map& *this.
+         */
+        perfect_hash_map& operator=(perfect_hash_map&& other) = default;
+
+        ~perfect_hash_map() = default;
+
+        /**
+         * @brief Safe access element.
+         * 
+         * @param key Key for the element.
+         * @return const_reference A reference to the mapped value.
+         * 
+         * @throw std::out_of_range If there's no matching key in the
+         *  container. Depending on the key storage policy, missing keys may
+         *  go undetected.
+         * @see operator[]
+         */
+        const_reference at(const key_type& key) const {
+            return key_storage_policy::value(m_slots[checked_slot(key)]);
+        }
+
+        reference at(const key_type& key) {
+            return key_storage_policy::value(m_slots[checked_slot(key)]);
+        }
+
+        /**
+         * @brief Safe access element by a key of a different type.
+         * 
+         * Only available if the hash function is transparent (e.g. a map
+         * keyed by std::string can be queried with a std::string_view).
+         * 
+         * @see at(const key_type&)
+         */
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        const_reference at(const K& key) const {
+            return key_storage_policy::value(m_slots[checked_slot(key)]);
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        reference at(const K& key) {
+            return key_storage_policy::value(m_slots[checked_slot(key)]);
+        }
+
+        /**
+         * @brief Access element.
+         * 
+         * @param key Key for the element.
+         * @return const_reference A reference to the mapped value.
+         * 
+         * @note If the container has no matching key, this operator has
+         *  undefined behavior.
+         * @see at
+         */
+        const_reference operator[](const key_type& key) const {
+            return key_storage_policy::value(m_slots[slot(key)]);
+        }
+
+        reference operator[](const key_type& key) {
+            return key_storage_policy::value(m_slots[slot(key)]);
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        const_reference operator[](const K& key) const {
+            return key_storage_policy::value(m_slots[slot(key)]);
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        reference operator[](const K& key) {
+            return key_storage_policy::value(m_slots[slot(key)]);
+        }
+
+        /**
+         * @brief Number of elements in the container.
+         */
+        size_type size() const {
+            return m_size;
+        }
+
+        bool empty() const {
+            return m_size == 0;
+        }
+
+        /**
+         * @brief Iterator to the first element.
+         * 
+         * Elements are visited in the order they were given to the
+         * constructor. Only available if the key storage policy keeps keys,
+         * and empty unless the map was built with build_options::iterable.
+         * Iterators point to slots (map_slot), with the key as `first` and
+         * the value as `second`, which can be unpacked like pairs.
+         * 
+         * @note Changing the key of an element through an iterator has
+         *  undefined behavior.
+         */
+        iterator begin() {
+            return iterator(m_slots.data(), m_index.data());
+        }
+
+        const_iterator begin() const {
+            return const_iterator(m_slots.data(), m_index.data());
+        }
+
+        const_iterator cbegin() const {
+            return begin();
+        }
+
+        /**
+         * @brief Iterator past the last element.
+         * 
+         * @see begin
+         */
+        iterator end() {
+            return iterator(m_slots.data(), m_index.data() + m_index.size());
+        }
+
+        const_iterator end() const {
+            return const_iterator(m_slots.data(),
+                                  m_index.data() + m_index.size());
+        }
+
+        const_iterator cend() const {
+            return end();
+        }
+
+        /**
+         * @brief Element lookup without exceptions.
+         * 
+         * Misses cost the same as hits: a key the engine rules out still
+         * reads a slot instead of branching away, and slots holding no
+         * element are filled so that no query can match them.
+         * 
+         * @param key Key for the element.
+         * @return const mapped_type* Pointer to the mapped value, or nullptr
+         *  if there's no matching key in the container. Depending on the key
+         *  storage policy, missing keys may go undetected.
+         */
+        const mapped_type* find(const key_type& key) const noexcept {
+            size_type s = lookup_slot(key);
+            return s == engine_type::npos
+                ? nullptr : &key_storage_policy::value(m_slots[s]);
+        }
+
+        mapped_type* find(const key_type& key) noexcept {
+            size_type s = lookup_slot(key);
+            return s == engine_type::npos
+                ? nullptr : &key_storage_policy::value(m_slots[s]);
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        const mapped_type* find(const K& key) const noexcept {
+            size_type s = lookup_slot(key);
+            return s == engine_type::npos
+                ? nullptr : &key_storage_policy::value(m_slots[s]);
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        mapped_type* find(const K& key) noexcept {
+            size_type s = lookup_slot(key);
+            return s == engine_type::npos
+                ? nullptr : &key_storage_policy::value(m_slots[s]);
+        }
+
+        /**
+         * @brief Checks whether the container has an element with a key.
+         * 
+         * @note With fingerprint_keys the answer may be a false positive;
+         *  with no_keys it is true for any key the engine can't rule out.
+         * @see find
+         */
+        bool contains(const key_type& key) const noexcept {
+            return lookup_slot(key) != engine_type::npos;
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        bool contains(const K& key) const noexcept {
+            return lookup_slot(key) != engine_type::npos;
+        }
+
+        /**
+         * @brief Batched element lookup.
+         * 
+         * Looks keys up in groups, hashing a whole group and prefetching its
+         * engine metadata, then its slots, before resolving any of them, so
+         * memory latency overlaps across keys instead of adding up.
+         * 
+         * @param keys Keys to look up.
+         * @param n Number of keys.
+         * @param out For each key, a pointer to its mapped value, or nullptr
+         *  if there's no matching key in the container.
+         */
+        void find_many(const key_type* keys, size_type n,
+                       const mapped_type** out) const {
+            profiled_find_many(*this, keys, n, out);
+        }
+
+        void find_many(const key_type* keys, size_type n,
+                       mapped_type** out) {
+            profiled_find_many(*this, keys, n, out);
+        }
+
+        /**
+         * @brief The map's lookup instrumentation, e.g. to take a
+         *  lookup_profiler's profile().
+         */
+        const instrumentation_type& instrumentation() const noexcept {
+            return this->policy();
+        }
+
+        instrumentation_type& instrumentation() noexcept {
+            return this->policy();
+        }
+
+        /**
+         * @brief Applies a change to the key set.
+         * 
+         * Erases the keys in `removed`, then inserts the elements in `added`,
+         * assigning the values of keys already in the map. Erasing keeps
+         * every function as is; only the first-level buckets receiving new
+         * keys are rebuilt, and those outgrowing their tables are moved past
+         * the end of the slot array. The whole map is rebuilt instead if it
+         * ends up with more keys per first-level bucket than
+         * build_options::load_factor, if moved tables have doubled the slot
+         * array since the last full build, or if the engine can't rebuild
+         * single buckets.
+         * 
+         * Bucket rebuilds, full rebuilds and the load factor they are
+         * checked against follow the options the map was built with (see
+         * options()).
+         * 
+         * Inserted elements are iterated after the existing ones, and the
+         * last element takes the place of each erased one. Build statistics
+         * keep describing the last full build.
+         * 
+         * @tparam Added collection of key-value pairs.
+         * @tparam Removed collection of keys.
+         * @param added Elements to insert or assign. If a key is repeated,
+         *  the last value wins.
+         * @param removed Keys to erase. Keys not in the map are ignored.
+         * 
+         * @note Requires copy constructible and assignable values.
+         * @throw std::logic_error If the map was built without an index (see
+         *  build_options::iterable).
+         */
+        template <typename Added, typename Removed>
+        void update(const Added& added, const Removed& removed) {
+            build_options options = m_options;
+            update(added, removed, options);
+        }
+
+        /**
+         * @brief Applies a change to the key set, with new build options.
+         * 
+         * The options replace those the map was built with, for this update
+         * and later ones.
+         * 
+         * @param options Build options, for rebuilds.
+         * @see update(const Added&, const Removed&)
+         */
+        template <typename Added, typename Removed>
+        void update(const Added& added, const Removed& removed,
+                    const build_options& options) {
+            static_assert(key_storage_policy::stores_keys,
+                "only maps that store their keys can be updated");
+            if (m_index.size() != m_size)
+                throw std::logic_error("Map was built without an index");
+
+            hash_family family = seeded_family<hash_family>(options.seed);
+            if constexpr (engine_type::incremental) index_positions();
+
+            for (const auto& key : removed) {
+                size_type s = find_slot(key);
+                if (s == engine_type::npos || !m_slots.occupied(s)) continue;
+                m_slots.erase(s, m_key_storage, *m_resident);
+                if constexpr (engine_type::incremental) unindex(s);
+                m_size--;
+            }
+
+            std::vector<value_type> inserted;
+            for (const auto& element : added) {
+                size_type s = find_slot(element.first);
+                if (s != engine_type::npos && m_slots.occupied(s))
+                    key_storage_policy::value(m_slots[s]) = element.second;
+                else
+                    inserted.emplace_back(element.first, element.second);
+            }
+            deduplicate(inserted, family);
+
+            if constexpr (engine_type::incremental) {
+                if (m_size + inserted.size()
+                        <= m_engine.bucket_count() * options.load_factor) {
+                    update_buckets(inserted, family, options);
+                    if (m_engine.capacity() <= 2 * m_stats.slots) {
+                        refresh_resident();
+                        remember(options);
+                        return;
+                    }
+                    inserted.clear();
+                }
+            }
+
+            std::vector<value_type> elements;
+            elements.reserve(m_size + inserted.size());
+            for (size_type s : m_index) {
+                if (!m_slots.occupied(s)) continue;
+                elements.emplace_back(m_slots[s].first,
+                    std::move(key_storage_policy::value(m_slots[s])));
+            }
+            for (value_type& element : inserted)
+                elements.push_back(std::move(element));
+
+            m_index.clear();
+            m_stats = build_statistics();
+            populate(std::make_move_iterator(elements.begin()),
+                     std::make_move_iterator(elements.end()),
+                     family, options);
+        }
+
+        /**
+         * @brief Writes the container to a binary stream.
+         * 
+         * The hash parameters and the slot array are written as they are in
+         * memory, so perfect_hash_map_view can query the result in place.
+         * 
+         * @param os Output stream, opened in binary mode.
+         * 
+         * @throw std::runtime_error If writing fails.
+         */
+        void save(std::ostream& os) const {
+            binary_writer writer(os);
+            save(writer);
+        }
+
+        /**
+         * @brief Writes the container as part of a larger binary file.
+         * 
+         * perfect_hash_map_view can read it back from a binary_reader at
+         * the same position.
+         */
+        void save(binary_writer& writer) const {
+            static_assert(std::is_trivially_copyable_v<mapped_type>
+                    && (std::is_trivially_copyable_v<key_type>
+                        || !key_storage_policy::stores_keys),
+                "only maps of trivially copyable values, and keys if they "
+                "are stored, can be serialized");
+
+            writer.write(header());
+            m_engine.save(writer);
+            m_key_storage.save(writer);
+            writer.write(uint64_t(m_size));
+            size_type slot_count =
+                std::min(m_slots.size(), m_engine.capacity());
+            writer.write_array(m_slots.data(), slot_count);
+            writer.write_array(m_slots.occupancy(), (slot_count + 63) / 64);
+        }
+
+        /**
+         * @brief Writes the container to a file.
+         * 
+         * @param path Path to the file, which is overwritten.
+         * 
+         * @throw std::runtime_error If writing fails.
+         * @see save(std::ostream&)
+         */
+        void save(const std::string& path) const {
+            std::ofstream os(path, std::ios::binary | std::ios::trunc);
+            if (!os) throw std::runtime_error("Could not open " + path);
+            save(os);
+        }
+
+        /**
+         * @brief Statistics collected while the container was built.
+         */
+        const build_statistics& build_stats() const {
+            return m_stats;
+        }
+
+        /**
+         * @brief Options the container was built with, or last updated
+         *  with, which update() builds with by default.
+         * 
+         * The scratch resource is not kept, since it may not outlive the
+         * build.
+         */
+        const build_options& options() const {
+            return m_options;
+        }
+
+        /**
+         * @brief Memory used by the container, in bytes.
+         * 
+         * Includes the estimated allocator overhead of every heap block the
+         * container owns, but not memory owned by the keys and values
+         * themselves (e.g. the buffers of long strings).
+         */
+        size_type memory_usage() const {
+            return sizeof(*this)
+                + m_engine.memory_usage()
+                + m_slots.memory_usage()
+                + perfhash::memory_usage(m_index)
+                + perfhash::memory_usage(m_position)
+                + perfhash::memory_usage(m_stats.bucket_sizes)
+                + perfhash::memory_usage(m_stats.retries);
+        }
+
+        /**
+         * @brief Header identifying files written by save().
+         */
+        static file_header header() {
+            file_header header;
+            header.engine = engine_type::tag;
+            header.hash_size = sizeof(hash_function);
+            header.key_size = sizeof(key_type);
+            header.value_size = sizeof(mapped_type);
+            header.slot_size = sizeof(slot_type);
+            header.key_storage = key_storage_policy::tag;
+            return header;
+        }
+    private:
+        using slot_allocator_type = typename std::allocator_traits<
+            allocator_type>::template rebind_alloc<slot_type>;
+        using index_allocator_type = typename std::allocator_traits<
+            allocator_type>::template rebind_alloc<size_type>;
+
+        /**
+         * @brief Slot array with an occupancy bitmap.
+         * 
+         * Every slot is constructed, keeping what the key storage policy
+         * keeps of a key, but values only live in the slots whose bit is
+         * set. Whoever constructs a value in a slot marks it; erase()
+         * destroys it again.
+         */
+        class slot_array {
+        public:
+            using allocator_traits = std::allocator_traits<slot_allocator_type>;
+            using bitmap_allocator_type = typename allocator_traits::
+                template rebind_alloc<uint64_t>;
+
+            explicit slot_array(const slot_allocator_type& allocator)
+                : m_allocator(allocator),
+                  m_occupied(bitmap_allocator_type(allocator)) {}
+
+            slot_array(const slot_array& other,
+                       const slot_allocator_type& allocator)
+                : slot_array(allocator) {
+                assign(other);
+            }
+
+            slot_array(slot_array&& other) noexcept
+                : m_allocator(std::move(other.m_allocator)),
+                  m_data(std::exchange(other.m_data, nullptr)),
+                  m_size(std::exchange(other.m_size, 0)),
+                  m_occupied(std::move(other.m_occupied)) {}
+
+            slot_array& operator=(slot_array&& other) {
+                if (this == &other) return *this;
+                constexpr bool propagate = allocator_traits::
+                    propagate_on_container_move_assignment::value;
+                if (!propagate && m_allocator != other.m_allocator) {
+                    assign(std::move(other));
+                    return *this;
+                }
+                clear();
+                if constexpr (propagate)
+                    m_allocator = std::move(other.m_allocator);
+                m_data = std::exchange(other.m_data, nullptr);
+                m_size = std::exchange(other.m_size, 0);
+                m_occupied = std::move(other.m_occupied);
+                return *this;
+            }
+
+            ~slot_array() {
+                clear();
+            }
+
+            /**
+             * @brief Replaces the contents with `count` slots holding no
+             *  element.
+             * 
+             * @param resident Key of an element of the map, or nullptr.
+             */
+            void reset(size_type count, const key_storage_policy& policy,
+                       const key_type* resident) {
+                allocate(count, [&](slot_type* slot, size_type) {
+                    policy.construct(slot, resident);
+                });
+            }
+
+            /**
+             * @brief Grows the array to `count` slots, moving values over.
+             */
+            void grow(size_type count, const key_storage_policy& policy,
+                      const key_type* resident) {
+                slot_array grown(m_allocator);
+                grown.allocate(count, [&](slot_type* slot, size_type i) {
+                    if (i < m_size) construct_like(slot, m_data[i]);
+                    else policy.construct(slot, resident);
+                });
+                grown.take_values(m_data, *this);
+                *this = std::move(grown);
+            }
+
+            /**
+             * @brief Marks a slot as holding the value just placed in it.
+             */
+            void mark(size_type i) {
+                m_occupied[i / 64] |= uint64_t(1) << (i % 64);
+            }
+
+            /**
+             * @brief Destroys the value in a slot and marks it empty.
+             * 
+             * @param resident Key of an element of the map.
+             */
+            void erase(size_type i, const key_storage_policy& policy,
+                       const key_type& resident) {
+                mapped_type& value = key_storage_policy::value(m_data[i]);
+                std::destroy_at(&value);
+                // So saved maps don't depend on what the slot held before.
+                std::memset(static_cast<void*>(&value), 0, sizeof(value));
+                policy.vacate(m_data[i], resident);
+                m_occupied[i / 64] &= ~(uint64_t(1) << (i % 64));
+            }
+
+            bool occupied(size_type i) const noexcept {
+                return (m_occupied[i / 64] >> (i % 64)) & 1;
+            }
+
+            /**
+             * @brief The occupancy bitmap: bit i % 64 of word i / 64 is set
+             *  if slot i holds an element.
+             */
+            const uint64_t* occupancy() const noexcept {
+                return m_occupied.data();
+            }
+
+            slot_type& operator[](size_type i) noexcept {
+                return m_data[i];
+            }
+
+            const slot_type& operator[](size_type i) const noexcept {
+                return m_data[i];
+            }
+
+            slot_type* data() noexcept {
+                return m_data;
+            }
+
+            const slot_type* data() const noexcept {
+                return m_data;
+            }
+
+            size_type size() const noexcept {
+                return m_size;
+            }
+
+            const slot_allocator_type& get_allocator() const {
+                return m_allocator;
+            }
+
+            size_type memory_usage() const {
+                return (m_data ? m_size * sizeof(slot_type)
+                            + allocation_overhead : 0)
+                    + perfhash::memory_usage(m_occupied);
+            }
+        private:
+            slot_allocator_type m_allocator;
+            slot_type* m_data = nullptr;
+            size_type m_size = 0;
+            std::vector<uint64_t, bitmap_allocator_type> m_occupied;
+
+            static void construct_like(slot_type* slot,
+                                       const slot_type& other) {
+                if constexpr (std::is_same_v<slot_type,
+                                             map_slot<void, mapped_type>>)
+                    new (slot) slot_type();
+                else
+                    new (slot) slot_type(other.first);
+            }
+
+            /**
+             * @brief Allocates and zero-fills `count` slots, constructing
+             *  each with `init(slot, i)`, in place of the current ones.
+             */
+            template <typename Init>
+            void allocate(size_type count, const Init& init) {
+                slot_type* data = allocator_traits::allocate(m_allocator,
+                                                             count);
+                std::memset(static_cast<void*>(data), 0,
+                            count * sizeof(slot_type));
+                size_type i = 0;
+                try {
+                    for (; i < count; i++) init(data + i, i);
+                } catch (...) {
+                    while (i > 0) std::destroy_at(data + --i);
+                    allocator_traits::deallocate(m_allocator, data, count);
+                    throw;
+                }
+                clear();
+                m_data = data;
+                m_size = count;
+                m_occupied.assign((count + 63) / 64, 0);
+            }
+
+            /**
+             * @brief Constructs the values of another array in the same
+             *  slots of this one, copying them, or moving them if `source`
+             *  is not const.
+             */
+            template <typename Slot>
+            void take_values(Slot* source, const slot_array& other) {
+                using value_reference = std::conditional_t<
+                    std::is_const_v<Slot>, const mapped_type&, mapped_type&&>;
+                for (size_type i = 0; i < other.m_size; i++) {
+                    if (!other.occupied(i)) continue;
+                    new (&key_storage_policy::value(m_data[i])) mapped_type(
+                        static_cast<value_reference>(
+                            key_storage_policy::value(source[i])));
+                    mark(i);
+                }
+            }
+
+            /**
+             * @brief Replaces the contents with those of another array,
+             *  copying values, or moving them if `other` is an rvalue.
+             */
+            template <typename Other>
+            void assign(Other&& other) {
+                allocate(other.m_size, [&](slot_type* slot, size_type i) {
+                    construct_like(slot, other.m_data[i]);
+                });
+                using source_slot = std::conditional_t<
+                    std::is_lvalue_reference_v<Other>,
+                    const slot_type, slot_type>;
+                take_values(static_cast<source_slot*>(other.m_data), other);
+            }
+
+            void clear() noexcept {
+                if (!m_data) return;
+                for (size_type i = 0; i < m_size; i++) {
+                    if (occupied(i))
+                        std::destroy_at(&key_storage_policy::value(m_data[i]));
+                    std::destroy_at(m_data + i);
+                }
+                allocator_traits::deallocate(m_allocator, m_data, m_size);
+                m_data = nullptr;
+                m_size = 0;
+                m_occupied.clear();
+            }
+        };
+
+        engine_type m_engine;
+        key_storage_policy m_key_storage;
+        slot_array m_slots;
+        std::vector<size_type, index_allocator_type> m_index;
+
+        /**
+         * @brief Position in m_index of the element in each slot.
+         * 
+         * Built by the first update() after a full build, so maps that are
+         * never updated don't pay for it.
+         */
+        std::vector<size_type, index_allocator_type> m_position;
+
+        size_type m_size = 0;
+        build_statistics m_stats;
+        build_options m_options;
+
+        /**
+         * @brief Key slots holding no element are marked with.
+         * 
+         * Some key in the map, or none if the map is empty. Slots may keep
+         * an earlier resident, though not in the tables its own bucket has
+         * had since (see refresh_resident). Only stored_keys makes use of
+         * it.
+         */
+        std::optional<key_type> m_resident;
+
+        static constexpr size_type batch_size = 32;
+
+        template <typename K>
+        size_type slot(const K& key) const {
+            return m_engine.slot(key);
+        }
+
+        template <typename Self, typename Pointer>
+        static void find_many(Self& self, const key_type* keys, size_type n,
+                              Pointer* out) {
+            size_type slots[batch_size];
+            for (size_type base = 0; base < n; base += batch_size) {
+                size_type m = std::min(batch_size, n - base);
+                self.m_engine.probe_many(keys + base, m, slots);
+
+                for (size_type i = 0; i < m; i++)
+                    if (slots[i] < self.m_slots.size())
+                        prefetch(&self.m_slots[slots[i]]);
+
+                for (size_type i = 0; i < m; i++) {
+                    size_type s = self.resolve(slots[i], keys[base + i]);
+                    out[base + i] = s == engine_type::npos
+                        ? nullptr : &key_storage_policy::value(self.m_slots[s]);
+                }
+            }
+        }
+
+        /**
+         * @brief find_many, sampled by the instrumentation as one call.
+         */
+        template <typename Self, typename Pointer>
+        static void profiled_find_many(Self& self, const key_type* keys,
+                                       size_type n, Pointer* out) {
+            if constexpr (instrumentation_type::enabled) {
+                if (self.instrumentation().sample()) {
+                    auto measurement = self.instrumentation().begin();
+                    find_many(self, keys, n, out);
+                    size_type hits = 0;
+                    for (size_type i = 0; i < n; i++)
+                        hits += out[i] != nullptr;
+                    self.instrumentation().end(measurement, n, hits);
+                    return;
+                }
+            }
+            find_many(self, keys, n, out);
+        }
+
+        /**
+         * @brief Drops elements whose key is repeated later on.
+         */
+        static void deduplicate(std::vector<value_type>& elements,
+                                hash_family& family) {
+            hash_function hash = family.sample(hash_function::w);
+            std::vector<std::pair<hash_t, size_type>> order;
+            order.reserve(elements.size());
+            for (size_type i = 0; i < elements.size(); i++)
+                order.emplace_back(hash(elements[i].first), i);
+            std::sort(order.begin(), order.end());
+
+            std::vector<bool> dropped(elements.size(), false);
+            for (size_type i = 0; i < order.size(); i++) {
+                for (size_type j = i + 1;
+                        j < order.size() && order[j].first == order[i].first;
+                        j++) {
+                    size_type a = order[i].second, b = order[j].second;
+                    if (elements[a].first == elements[b].first)
+                        dropped[std::min(a, b)] = true;
+                }
+            }
+
+            // Kept elements only move when something before them was dropped:
+            // moving an element onto itself may empty it.
+            size_type kept = 0;
+            for (size_type i = 0; i < elements.size(); i++) {
+                if (dropped[i]) continue;
+                if (kept != i) elements[kept] = std::move(elements[i]);
+                kept++;
+            }
+            elements.erase(elements.begin() + kept, elements.end());
+        }
+
+        /**
+         * @brief Inserts new elements by rebuilding only their buckets.
+         * 
+         * Every bucket is rebuilt before any element is placed, so the slot
+         * array grows at most once. Only the slots of rebuilt buckets and
+         * the index entries of their elements are touched.
+         * 
+         * @param inserted Elements with keys not in the map.
+         * @param family Hash family to draw functions from.
+         * @param options Build options, for the retry budget and timeout.
+         */
+        void update_buckets(std::vector<value_type>& inserted,
+                            hash_family& family,
+                            const build_options& options) {
+            // Slots added for the new buckets are marked with m_resident.
+            if (!m_resident && !inserted.empty())
+                m_resident = inserted.front().first;
+
+            std::vector<std::pair<size_type, size_type>> order;
+            order.reserve(inserted.size());
+            for (size_type i = 0; i < inserted.size(); i++)
+                order.emplace_back(m_engine.bucket(inserted[i].first), i);
+            std::sort(order.begin(), order.end());
+
+            // Elements of the rebuilt buckets, each with its position in
+            // m_index (npos if inserted), and where each bucket starts.
+            std::vector<value_type> members;
+            std::vector<size_type> positions;
+            std::vector<std::pair<size_type, size_type>> rebuilt;
+            for (size_type i = 0; i < order.size();) {
+                size_type b = order[i].first;
+                size_type start = members.size();
+
+                auto [first, last] = m_engine.bucket_slots(b);
+                for (size_type s = first; s < last; s++) {
+                    if (!m_slots.occupied(s)) continue;
+                    members.emplace_back(m_slots[s].first,
+                                         std::move(m_slots[s].second));
+                    positions.push_back(m_position[s]);
+                    m_slots.erase(s, m_key_storage, *m_resident);
+                }
+                for (; i < order.size() && order[i].first == b; i++) {
+                    members.push_back(std::move(inserted[order[i].second]));
+                    positions.push_back(engine_type::npos);
+                }
+
+                m_engine.rebuild_bucket(b, members.size() - start,
+                    [&](size_type j) -> const auto& {
+                        return members[start + j].first;
+                    },
+                    family, options);
+                rebuilt.emplace_back(b, start);
+            }
+            reserve_slots(m_engine.capacity());
+
+            for (size_type k = 0; k < rebuilt.size(); k++) {
+                auto [b, start] = rebuilt[k];
+                size_type end = k + 1 < rebuilt.size()
+                    ? rebuilt[k + 1].second : members.size();
+
+                // A table moved past the end lands on slots that may be
+                // marked with an older resident.
+                auto [first, last] = m_engine.bucket_slots(b);
+                for (size_type s = first; s < last; s++)
+                    if (!m_slots.occupied(s))
+                        m_key_storage.vacate(m_slots[s], *m_resident);
+
+                for (size_type j = start; j < end; j++) {
+                    size_type s = m_engine.slot(members[j].first);
+                    m_key_storage.place(m_slots[s], std::move(members[j]));
+                    m_slots.mark(s);
+
+                    size_type p = positions[j];
+                    if (p == engine_type::npos) {
+                        p = m_index.size();
+                        m_index.push_back(s);
+                    } else {
+                        m_index[p] = s;
+                    }
+                    m_position[s] = p;
+                }
+            }
+            m_size += inserted.size();
+        }
+
+        /**
+         * @brief Grows the slot array to at least `count` slots.
+         * 
+         * Grows by half again, short of the size at which update() rebuilds
+         * the whole map, so tables moving out one update at a time only
+         * copy the array a logarithmic number of times.
+         */
+        void reserve_slots(size_type count) {
+            if (count <= m_slots.size()) return;
+            size_type grown = std::max(count, std::min(
+                m_slots.size() + m_slots.size() / 2, 2 * m_stats.slots));
+            m_slots.grow(grown, m_key_storage, resident());
+            m_position.resize(grown, engine_type::npos);
+        }
+
+        /**
+         * @brief Fills m_position in, unless it is up to date.
+         */
+        void index_positions() {
+            if (m_position.size() == m_slots.size()) return;
+            m_position.assign(m_slots.size(), engine_type::npos);
+            for (size_type i = 0; i < m_index.size(); i++)
+                m_position[m_index[i]] = i;
+        }
+
+        /**
+         * @brief Drops an erased slot from m_index, moving the last entry
+         *  into its place.
+         */
+        void unindex(size_type s) {
+            size_type p = m_position[s];
+            size_type last = m_index.back();
+            m_index[p] = last;
+            m_position[last] = p;
+            m_index.pop_back();
+            m_position[s] = engine_type::npos;
+        }
+
+        template <typename K>
+        size_type find_slot(const K& key) const noexcept {
+            return resolve(m_engine.probe(key), key);
+        }
+
+        /**
+         * @brief find_slot for public lookups, which are instrumented.
+         */
+        template <typename K>
+        size_type lookup_slot(const K& key) const noexcept {
+            if constexpr (instrumentation_type::enabled) {
+                if (instrumentation().sample()) {
+                    auto measurement = instrumentation().begin();
+                    size_type s = find_slot(key);
+                    instrumentation().end(measurement, 1,
+                                          s != engine_type::npos);
+                    return s;
+                }
+            }
+            return find_slot(key);
+        }
+
+        /**
+         * @brief Checks a probed slot against the key that probed it.
+         * 
+         * Written to compile to selects rather than branches: a slot the
+         * engine ruled out is replaced by the first slot, which is compared
+         * all the same, and the comparison result is masked instead of
+         * short-circuited. Only empty maps, which may have no slots, return
+         * early. With stored_keys, empty slots need no check of
+         * their own, since they are marked with m_resident; other policies
+         * check the occupancy bitmap too, so no query reaches a slot with no
+         * value in it.
+         * 
+         * @param i Slot returned by the engine's probe, or npos.
+         * @return size_type `i`, or npos if the key is not there.
+         */
+        template <typename K>
+        size_type resolve(size_type i, const K& key) const noexcept {
+            if (m_size == 0) return engine_type::npos;
+            assert(i == engine_type::npos || i < m_slots.size());
+            size_type j = i == engine_type::npos ? 0 : i;
+            bool found = (i != engine_type::npos)
+                & m_key_storage.matches(m_slots[j], key);
+            if constexpr (!key_storage_policy::stores_keys)
+                found &= m_slots.occupied(j);
+            return found ? i : engine_type::npos;
+        }
+
+        const key_type* resident() const {
+            return m_resident ? &*m_resident : nullptr;
+        }
+
+        void remember(const build_options& options) {
+            m_options = options;
+            m_options.scratch = nullptr;
+        }
+
+        /**
+         * @brief Picks a new m_resident if its key is no longer in the map.
+         * 
+         * Only keys of the old resident's bucket are looked up in that
+         * bucket's table, so empty slots elsewhere keep the old key.
+         */
+        void refresh_resident() {
+            if (m_size == 0) return;
+
+            size_type s = find_slot(*m_resident);
+            if (s != engine_type::npos && m_slots.occupied(s)) return;
+
+            size_type b = m_engine.bucket(*m_resident);
+            m_resident = m_slots[m_index.front()].first;
+            auto [first, last] = m_engine.bucket_slots(b);
+            for (size_type i = first; i < last; i++)
+                if (!m_slots.occupied(i))
+                    m_key_storage.vacate(m_slots[i], *m_resident);
+        }
+
+        template <typename K>
+        size_type checked_slot(const K& key) const {
+            size_type i = lookup_slot(key);
+            if (i == engine_type::npos)
+                throw std::out_of_range("No such key");
+            return i;
+        }
+
+        template <typename Iterator>
+        void populate(const Iterator& first, const Iterator& last,
+                      hash_family& family, const build_options& options) {
+            std::pmr::vector<Iterator> elements(options.scratch_resource());
+            for (auto it = first; it != last; it++)
+                elements.push_back(it);
+            m_size = elements.size();
+
+            m_engine.build(elements.size(),
+                [&](size_type i) -> const auto& { return elements[i]->first; },
+                family, options, m_stats);
+            remember(options);
+
+            scoped_timer timer(m_stats.placement_time);
+            m_key_storage.sample(family);
+            // Empty slots are marked with an element's key, so an empty map
+            // gets no slots, and resolve() reads none.
+            if (elements.empty()) m_resident.reset();
+            else m_resident = elements[0]->first;
+            m_slots.reset(elements.empty() ? 0 : m_engine.capacity(),
+                          m_key_storage, resident());
+            m_position.clear();
+
+            // Slots are marked once all are placed, since threads placing
+            // elements next to each other would share bitmap words.
+            std::pmr::vector<size_type> placed(options.scratch_resource());
+            if (key_storage_policy::stores_keys && options.iterable)
+                m_index.resize(elements.size());
+            else
+                placed.resize(elements.size());
+            size_type* positions = m_index.empty()
+                ? placed.data() : m_index.data();
+            parallel_for(options.threads, elements.size(), [&](size_type i) {
+                size_type s = m_engine.slot(elements[i]->first);
+                m_key_storage.place(m_slots[s], *elements[i]);
+                positions[i] = s;
+            });
+            for (size_type i = 0; i < elements.size(); i++)
+                m_slots.mark(positions[i]);
+        }
+    };
+
+    namespace pmr {
+        /**
+         * @brief perfect_hash_map allocating its slots through a
+         *  std::pmr::memory_resource given at construction.
+         */
+        template <
+            typename Key,
+            typename Value,
+            typename HashFamily = ru_hash_family<Key>,
+            template <typename, typename> typename Engine = fks_engine,
+            typename KeyStorage = stored_keys,
+            typename Instrumentation = no_instrumentation
+        > using perfect_hash_map = perfhash::perfect_hash_map<Key, Value,
+            HashFamily, std::pmr::polymorphic_allocator<std::pair<Key, Value>>,
+            Engine, KeyStorage, Instrumentation>;
+    }
+
+    /**
+     * @brief Read-only view of a serialized perfect_hash_map.
+     * 
+     * Answers queries directly on the bytes written by
+     * perfect_hash_map::save, typically memory-mapped from a file, without
+     * deserializing or allocating anything.
+     * 
+     * @tparam Key type of key used in the map.
+     * @tparam Value type of value stored in the map.
+     * @tparam HashFamily randomized universal hash family.
+     * @tparam Engine construction engine.
+     * @tparam KeyStorage key storage policy the map was built with.
+     */
+    template <
+        typename Key,
+        typename Value,
+        typename HashFamily = ru_hash_family<Key>,
+        template <typename, typename> typename Engine = fks_engine,
+        typename KeyStorage = stored_keys
+    > class perfect_hash_map_view {
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using value_type = std::pair<key_type, mapped_type>;
+        using size_type = size_t;
+        using const_reference = const Value&;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+        using engine_type = Engine<key_type, hash_family>;
+        using key_storage_policy = typename KeyStorage::template policy<
+            key_type, mapped_type, hash_family>;
+        using slot_type = typename key_storage_policy::slot_type;
+
+        /**
+         * @brief Views a serialized map held in memory.
+         * 
+         * @param data Serialized map, aligned to binary_writer::alignment. It
+         *  must outlive the view.
+         * @param size Size of the data, in bytes.
+         * 
+         * @throw std::runtime_error If the data was not written by a
+         *  compatible perfect_hash_map.
+         */
+        perfect_hash_map_view(const void* data, size_type size) {
+            load(static_cast<const char*>(data), size);
+        }
+
+#if defined(__unix__) || defined(__APPLE__)
+        /**
+         * @brief Memory-maps a file written by perfect_hash_map::save.
+         * 
+         * @param path Path to the file.
+         * 
+         * @throw std::runtime_error If the file can't be mapped or was not
+         *  written by a compatible perfect_hash_map.
+         */
+        explicit perfect_hash_map_view(const std::string& path)
+            : m_file(std::make_shared<mapped_file>(path)) {
+            load(m_file->data(), m_file->size());
+        }
+#endif
+
+        /**
+         * @brief Views a map written by perfect_hash_map::save(binary_writer&)
+         *  as part of a larger file.
+         * 
+         * @param reader Reader positioned where the map was written, left
+         *  past its end. The data it reads must outlive the view.
+         * 
+         * @throw std::runtime_error If the data was not written by a
+         *  compatible perfect_hash_map.
+         */
+        explicit perfect_hash_map_view(binary_reader& reader) {
+            load(reader);
+        }
+
+        /**
+         * @brief Safe access element.
+         * 
+         * @param key Key for the element.
+         * @return const_reference A reference to the mapped value.
+         * 
+         * @throw std::out_of_range If there's no matching key in the
+         *  container.
+         * @see operator[]
+         */
+        const_reference at(const key_type& key) const {
+            const mapped_type* value = find(key);
+            if (!value) throw std::out_of_range("No such key");
+            return *value;
+        }
+
+        /**
+         * @brief Element lookup without exceptions.
+         * 
+         * @return const mapped_type* Pointer to the mapped value, or nullptr
+         *  if there's no matching key in the container.
+         * @see perfect_hash_map::find
+         */
+        const mapped_type* find(const key_type& key) const noexcept {
+            size_type i = m_engine.probe(key);
+            return i != engine_type::npos && m_size != 0
+                    && m_key_storage.matches(m_slots[i], key) && occupied(i)
+                ? &key_storage_policy::value(m_slots[i]) : nullptr;
+        }
+
+        bool contains(const key_type& key) const noexcept {
+            return find(key) != nullptr;
+        }
+
+        /**
+         * @brief Number of elements in the map.
+         */
+        size_type size() const {
+            return m_size;
+        }
+
+        /**
+         * @brief Access element.
+         * 
+         * @param key Key for the element.
+         * @return const_reference A reference to the mapped value.
+         * 
+         * @note If the container has no matching key, this operator has
+         *  undefined behavior.
+         * @see at
+         */
+        const_reference operator[](const key_type& key) const {
+            return key_storage_policy::value(m_slots[m_engine.slot(key)]);
+        }
+    private:
+        using map_type = perfect_hash_map<key_type, mapped_type, hash_family,
+            std::allocator<value_type>, Engine, KeyStorage>;
+
+#if defined(__unix__) || defined(__APPLE__)
+        std::shared_ptr<const mapped_file> m_file;
+#endif
+        typename engine_type::view_type m_engine;
+        key_storage_policy m_key_storage;
+        const slot_type* m_slots = nullptr;
+        const uint64_t* m_occupied = nullptr;
+        size_type m_size = 0;
+
+        /**
+         * @brief Whether a slot holds an element. Stored keys tell by
+         *  themselves, as in perfect_hash_map::resolve.
+         */
+        bool occupied(size_type i) const noexcept {
+            return key_storage_policy::stores_keys
+                || ((m_occupied[i / 64] >> (i % 64)) & 1);
+        }
+
+        void load(const char* data, size_type size) {
+            binary_reader reader(data, size);
+            load(reader);
+        }
+
+        void load(binary_reader& reader) {
+            if (!(reader.read<file_header>() == map_type::header()))
+                throw std::runtime_error("Incompatible perfect hash");
+
+            m_engine = engine_type::view_type::load(reader);
+            m_key_storage = key_storage_policy::load(reader);
+            m_size = size_type(reader.read<uint64_t>());
+            size_type slot_count, word_count;
+            m_slots = reader.read_array<slot_type>(slot_count);
+            m_occupied = reader.read_array<uint64_t>(word_count);
+            // Maps that were never populated are saved with no slots.
+            bool unpopulated = slot_count == 0 && m_size == 0;
+            if ((slot_count != m_engine.capacity() && !unpopulated)
+                    || m_size > slot_count
+                    || word_count != (slot_count + 63) / 64)
+                throw std::runtime_error("Malformed perfect hash");
+        }
+    };
+
+    /**
+     * @brief Assigns keys to the shards of a sharded_perfect_hash_map.
+     * 
+     * Fully determined by a global seed and a number of shards, so builders
+     * and clients on different machines agree on which shard owns a key
+     * without any coordination, and every shard is built from a seed of its
+     * own, derived from the global one.
+     * 
+     * @tparam Key type of key to be routed.
+     * @tparam HashFamily randomized universal hash family.
+     */
+    template <typename Key, typename HashFamily = ru_hash_family<Key>>
+    class shard_router {
+    public:
+        using key_type = Key;
+        using size_type = size_t;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+
+        static constexpr uint32_t tag = 0x44524853; // "SHRD"
+
+        /**
+         * @brief Constructs a router.
+         * 
+         * @param seed Global seed.
+         * @param shard_count Number of shards.
+         * 
+         * @throw std::invalid_argument If there are no shards.
+         */
+        shard_router(uint64_t seed, size_type shard_count)
+            : m_seed(seed), m_shard_count(shard_count) {
+            if (shard_count == 0)
+                throw std::invalid_argument("No shards");
+            m_hash = seeded_family<hash_family>(seed).sample(
+                hash_function::w);
+        }
+
+        /**
+         * @brief Shard owning a key.
+         */
+        template <typename K>
+        size_type shard_of(const K& key) const {
+            return size_type(reduce(m_hash(key), m_shard_count));
+        }
+
+        size_type shard_count() const {
+            return m_shard_count;
+        }
+
+        uint64_t seed() const {
+            return m_seed;
+        }
+
+        /**
+         * @brief Seed a shard is built from (see build_options::seed).
+         */
+        uint64_t shard_seed(size_type shard) const {
+            return mix64(m_seed + (shard + 1) * 0x9E3779B97F4A7C15ULL);
+        }
+
+        /**
+         * @brief Writes the router to a binary stream.
+         * 
+         * The routing function is written along with the seed, so readers
+         * route keys the same way even if their hash family would draw a
+         * different function from that seed.
+         * 
+         * @throw std::runtime_error If writing fails.
+         */
+        void save(std::ostream& os) const {
+            binary_writer writer(os);
+            writer.write(header());
+            writer.write(m_seed);
+            writer.write(uint64_t(m_shard_count));
+            writer.write(m_hash);
+        }
+
+        void save(const std::string& path) const {
+            std::ofstream os(path, std::ios::binary | std::ios::trunc);
+            if (!os) throw std::runtime_error("Could not open " + path);
+            save(os);
+        }
+
+        /**
+         * @brief Reads a router written by save().
+         * 
+         * @throw std::runtime_error If the data was not written by a
+         *  compatible router.
+         */
+        static shard_router load(const void* data, size_type size) {
+            binary_reader reader(static_cast<const char*>(data), size);
+            if (!(reader.read<file_header>() == header()))
+                throw std::runtime_error("Incompatible shard router");
+
+            uint64_t seed = reader.read<uint64_t>();
+            uint64_t shard_count = reader.read<uint64_t>();
+            shard_router router(seed, shard_count);
+            router.m_hash = reader.read<hash_function>();
+            return router;
+        }
+
+        static shard_router load(const std::string& path) {
+            std::ifstream is(path, std::ios::binary);
+            if (!is) throw std::runtime_error("Could not open " + path);
+            std::string data((std::istreambuf_iterator<char>(is)),
+                             std::istreambuf_iterator<char>());
+            return load(data.data(), data.size());
+        }
+
+        /**
+         * @brief Path of the router among files sharing a prefix.
+         */
+        static std::string router_path(const std::string& prefix) {
+            return prefix + ".router";
+        }
+
+        /**
+         * @brief Path of a shard among files sharing a prefix.
+         */
+        static std::string shard_path(const std::string& prefix,
+                                      size_type shard) {
+            return prefix + "." + std::to_string(shard);
+        }
+
+        static file_header header() {
+            file_header header;
+            header.engine = tag;
+            header.hash_size = sizeof(hash_function);
+            header.key_size = sizeof(key_type);
+            return header;
+        }
+
+        bool operator==(const shard_router& other) const {
+            return m_seed == other.m_seed
+                && m_shard_count == other.m_shard_count
+                && std::memcmp(&m_hash, &other.m_hash, sizeof(m_hash)) == 0;
+        }
+
+        bool operator!=(const shard_router& other) const {
+            return !(*this == other);
+        }
+    private:
+        uint64_t m_seed;
+        size_type m_shard_count;
+        hash_function m_hash;
+    };
+
+    /**
+     * @brief Perfect hash map split into independently built shards.
+     * 
+     * A shard_router assigns every key to one of N shards, each a complete
+     * perfect_hash_map of its own. Shards can be built on different machines
+     * with build_shard(), each from the whole input or just its part of it,
+     * and saved as ordinary map files; clients only need the router to send
+     * a query to the right one. This class assembles shards held in one
+     * process.
+     * 
+     * @tparam Key type of key used in the map.
+     * @tparam Value type of value stored in the map.
+     * @tparam HashFamily randomized universal hash family.
+     * @tparam Allocator allocator for the shards.
+     * @tparam Engine construction engine of the shards.
+     * @tparam KeyStorage key storage policy of the shards.
+     */
+    template <
+        typename Key,
+        typename Value,
+        typename HashFamily = ru_hash_family<Key>,
+        typename Allocator = std::allocator<std::pair<Key, Value>>,
+        template <typename, typename> typename Engine = fks_engine,
+        typename KeyStorage = stored_keys
+    > class sharded_perfect_hash_map {
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using value_type = std::pair<key_type, mapped_type>;
+        using size_type = size_t;
+        using reference = Value&;
+        using const_reference = const Value&;
+        using map_type = perfect_hash_map<Key, Value, HashFamily, Allocator,
+            Engine, KeyStorage>;
+        using router_type = shard_router<Key, HashFamily>;
+
+        /**
+         * @brief Builds every shard.
+         * 
+         * Shards are built concurrently, with up to build_options::threads
+         * of them at a time, and each is the same as build_shard() would
+         * make on its own.
+         * 
+         * @tparam Iterator STL iterator for a collection type.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param router Router assigning keys to shards.
+         * @param options Build options. The seed is ignored: each shard gets
+         *  its own from the router.
+         */
+        template <typename Iterator>
+        sharded_perfect_hash_map(Iterator first, Iterator last,
+                const router_type& router,
+                const build_options& options = build_options())
+            : m_router(router) {
+            std::vector<std::vector<Iterator>> parts(router.shard_count());
+            for (auto it = first; it != last; it++)
+                parts[router.shard_of(it->first)].push_back(it);
+
+            std::vector<std::optional<map_type>> shards(parts.size());
+            build_options shard_options = options;
+            shard_options.threads = 1;
+            parallel_for(options.threads, parts.size(), [&](size_type i) {
+                build_part(shards[i], router, i, parts[i], shard_options);
+            }, 1);
+
+            m_shards.reserve(shards.size());
+            for (auto& shard : shards) m_shards.push_back(std::move(*shard));
+        }
+
+        /**
+         * @brief Assembles shards built elsewhere.
+         * 
+         * @param router Router the shards were built with.
+         * @param shards The shards, in order.
+         * 
+         * @throw std::invalid_argument If the number of shards doesn't match
+         *  the router.
+         */
+        sharded_perfect_hash_map(const router_type& router,
+                                 std::vector<map_type> shards)
+            : m_router(router), m_shards(std::move(shards)) {
+            if (m_shards.size() != m_router.shard_count())
+                throw std::invalid_argument("Wrong number of shards");
+        }
+
+        /**
+         * @brief Builds a single shard.
+         * 
+         * Elements owned by other shards are skipped, so every builder can
+         * be given the whole input, or only its own part of it.
+         * 
+         * @param router Router assigning keys to shards.
+         * @param shard Index of the shard to build.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param options Build options. The seed is ignored: the shard gets
+         *  its own from the router.
+         */
+        template <typename Iterator>
+        static map_type build_shard(const router_type& router,
+                size_type shard, Iterator first, Iterator last,
+                const build_options& options = build_options()) {
+            std::vector<Iterator> part;
+            for (auto it = first; it != last; it++)
+                if (router.shard_of(it->first) == shard) part.push_back(it);
+
+            std::optional<map_type> map;
+            build_part(map, router, shard, part, options);
+            return std::move(*map);
+        }
+
+        /**
+         * @brief Safe access element.
+         * 
+         * @throw std::out_of_range If there's no matching key in the
+         *  container.
+         * @see perfect_hash_map::at
+         */
+        const_reference at(const key_type& key) const {
+            return m_shards[m_router.shard_of(key)].at(key);
+        }
+
+        reference at(const key_type& key) {
+            return m_shards[m_router.shard_of(key)].at(key);
+        }
+
+        const_reference operator[](const key_type& key) const {
+            return m_shards[m_router.shard_of(key)][key];
+        }
+
+        reference operator[](const key_type& key) {
+            return m_shards[m_router.shard_of(key)][key];
+        }
+
+        /**
+         * @brief Element lookup without exceptions.
+         * 
+         * @see perfect_hash_map::find
+         */
+        const mapped_type* find(const key_type& key) const noexcept {
+            return m_shards[m_router.shard_of(key)].find(key);
+        }
+
+        mapped_type* find(const key_type& key) noexcept {
+            return m_shards[m_router.shard_of(key)].find(key);
+        }
+
+        bool contains(const key_type& key) const noexcept {
+            return m_shards[m_router.shard_of(key)].contains(key);
+        }
+
+        /**
+         * @brief Number of elements over all shards.
+         */
+        size_type size() const {
+            size_type total = 0;
+            for (const map_type& shard : m_shards) total += shard.size();
+            return total;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        const router_type& router() const {
+            return m_router;
+        }
+
+        size_type shard_count() const {
+            return m_shards.size();
+        }
+
+        const map_type& shard(size_type i) const {
+            return m_shards[i];
+        }
+
+        /**
+         * @brief Writes the router and every shard to files sharing a
+         *  prefix (see shard_router::router_path and shard_path).
+         * 
+         * @throw std::runtime_error If writing fails.
+         */
+        void save(const std::string& prefix) const {
+            m_router.save(router_type::router_path(prefix));
+            for (size_type i = 0; i < m_shards.size(); i++)
+                m_shards[i].save(router_type::shard_path(prefix, i));
+        }
+
+        /**
+         * @brief Memory used by the container, in bytes.
+         */
+        size_type memory_usage() const {
+            size_type total = sizeof(*this) + perfhash::memory_usage(m_shards)
+                - m_shards.size() * sizeof(map_type);
+            for (const map_type& shard : m_shards)
+                total += shard.memory_usage();
+            return total;
+        }
+    private:
+        router_type m_router;
+        std::vector<map_type> m_shards;
+
+        /**
+         * @brief Iterator over the elements a vector of iterators points to.
+         */
+        template <typename Iterator>
+        class indirect_iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = typename std::iterator_traits<
+                Iterator>::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = typename std::iterator_traits<Iterator>::pointer;
+            using reference = typename std::iterator_traits<
+                Iterator>::reference;
+
+            explicit indirect_iterator(const Iterator* it) : m_it(it) {}
+
+            reference operator*() const {
+                return **m_it;
+            }
+
+            Iterator operator->() const {
+                return *m_it;
+            }
+
+            indirect_iterator& operator++() {
+                m_it++;
+                return *this;
+            }
+
+            indirect_iterator operator++(int) {
+                indirect_iterator old = *this;
+                m_it++;
+                return old;
+            }
+
+            bool operator==(const indirect_iterator& other) const {
+                return m_it == other.m_it;
+            }
+
+            bool operator!=(const indirect_iterator& other) const {
+                return m_it != other.m_it;
+            }
+        private:
+            const Iterator* m_it;
+        };
+
+        /**
+         * @brief Builds a shard from the elements its part points to.
+         */
+        template <typename Iterator>
+        static void build_part(std::optional<map_type>& map,
+                               const router_type& router, size_type shard,
+                               const std::vector<Iterator>& part,
+                               build_options options) {
+            options.seed = router.shard_seed(shard);
+            map.emplace(indirect_iterator<Iterator>(part.data()),
+                        indirect_iterator<Iterator>(part.data() + part.size()),
+                        options);
+        }
+    };
+
+    /**
+     * @brief Builds a sharded map from a stream too large to hold in memory.
+     * 
+     * Elements are fed one at a time, in a single pass, and buffered per
+     * shard; whenever the buffers reach the memory budget they are appended
+     * to one spill file per shard. finish() then reads the shards back one
+     * at a time, builds each, and writes it out in the format of
+     * sharded_perfect_hash_map::save, so only one shard is ever built in
+     * memory. Every shard is the same as build_shard() would make from the
+     * same elements.
+     * 
+     * The budget bounds the buffered elements, and the elements of the
+     * shard being built; building a shard needs several times more on top
+     * (slots, bucket headers, scratch). Choosing enough shards for the
+     * largest one to fit is up to the caller.
+     * 
+     * @tparam Key type of key used in the map.
+     * @tparam Value type of value stored in the map.
+     * @tparam HashFamily randomized universal hash family.
+     * @tparam Engine construction engine of the shards.
+     * @tparam KeyStorage key storage policy of the shards.
+     */
+    template <
+        typename Key,
+        typename Value,
+        typename HashFamily = ru_hash_family<Key>,
+        template <typename, typename> typename Engine = fks_engine,
+        typename KeyStorage = stored_keys
+    > class streaming_builder {
+        static_assert(std::is_trivially_copyable_v<Key>
+                && std::is_trivially_copyable_v<Value>,
+            "only trivially copyable keys and values can be spilled");
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using value_type = std::pair<key_type, mapped_type>;
+        using size_type = size_t;
+        using sharded_map_type = sharded_perfect_hash_map<Key, Value,
+            HashFamily, std::allocator<value_type>, Engine, KeyStorage>;
+        using map_type = typename sharded_map_type::map_type;
+        using router_type = shard_router<Key, HashFamily>;
+
+        /**
+         * @brief Starts a build.
+         * 
+         * @param prefix Prefix of the output files, and of the spill files
+         *  (`prefix.spill.<shard>`), which are removed when done.
+         * @param router Router assigning keys to shards.
+         * @param memory_budget Bytes of elements to hold in memory at once.
+         * @param options Build options for each shard. The seed is ignored:
+         *  each shard gets its own from the router.
+         */
+        streaming_builder(const std::string& prefix, const router_type& router,
+                          size_type memory_budget,
+                          const build_options& options = build_options())
+            : m_prefix(prefix), m_router(router), m_options(options),
+              m_budget(std::max(memory_budget, sizeof(record))),
+              m_buffers(router.shard_count()),
+              m_spilled(router.shard_count(), 0) {
+            for (size_type i = 0; i < m_spilled.size(); i++)
+                std::remove(spill_path(i).c_str());
+        }
+
+        streaming_builder(const streaming_builder&) = delete;
+        streaming_builder& operator=(const streaming_builder&) = delete;
+
+        ~streaming_builder() {
+            for (size_type i = 0; i < m_spilled.size(); i++)
+                std::remove(spill_path(i).c_str());
+        }
+
+        /**
+         * @brief Adds an element. Keys must all be distinct.
+         * 
+         * @throw std::runtime_error If a spill file can't be written.
+         */
+        void add(const key_type& key, const mapped_type& value) {
+            m_buffers[m_router.shard_of(key)].push_back({ key, value });
+            if (++m_buffered * sizeof(record) >= m_budget) spill();
+        }
+
+        /**
+         * @brief Adds every element of a range, in a single pass.
+         * 
+         * @tparam Iterator Input iterator over key-value pairs.
+         */
+        template <typename Iterator>
+        void add(Iterator first, Iterator last) {
+            for (; first != last; ++first) add(first->first, first->second);
+        }
+
+        /**
+         * @brief Builds and writes every shard, then the router.
+         * 
+         * @throw std::runtime_error If a shard holds more elements than fit
+         *  in the memory budget, or if a file can't be read or written.
+         */
+        void finish() {
+            spill();
+            std::vector<record> elements;
+            for (size_type i = 0; i < m_spilled.size(); i++) {
+                if (m_spilled[i] * sizeof(record) > m_budget)
+                    throw std::runtime_error(
+                        "Shard exceeds the memory budget");
+
+                elements.resize(m_spilled[i]);
+                if (!elements.empty()) {
+                    std::ifstream is(spill_path(i), std::ios::binary);
+                    is.read(reinterpret_cast<char*>(elements.data()),
+                            elements.size() * sizeof(record));
+                    if (!is)
+                        throw std::runtime_error("Could not read "
+                            + spill_path(i));
+                }
+
+                map_type shard = sharded_map_type::build_shard(m_router, i,
+                    elements.begin(), elements.end(), m_options);
+                shard.save(router_type::shard_path(m_prefix, i));
+                std::remove(spill_path(i).c_str());
+            }
+            m_router.save(router_type::router_path(m_prefix));
+        }
+
+        const router_type& router() const {
+            return m_router;
+        }
+
+        /**
+         * @brief Number of elements added so far.
+         */
+        size_type size() const {
+            size_type total = m_buffered;
+            for (size_type n : m_spilled) total += n;
+            return total;
+        }
+    private:
+        /**
+         * @brief Element as spilled to disk, with the member names of a
+         *  std::pair so shards can be built straight from it.
+         */
+        struct record {
+            key_type first;
+            mapped_type second;
+        };
+
+        std::string m_prefix;
+        router_type m_router;
+        build_options m_options;
+        size_type m_budget;
+        std::vector<std::vector<record>> m_buffers;
+        std::vector<size_type> m_spilled;
+        size_type m_buffered = 0;
+
+        std::string spill_path(size_type shard) const {
+            return m_prefix + ".spill." + std::to_string(shard);
+        }
+
+        /**
+         * @brief Appends every buffer to its shard's spill file.
+         */
+        void spill() {
+            for (size_type i = 0; i < m_buffers.size(); i++) {
+                std::vector<record>& buffer = m_buffers[i];
+                if (buffer.empty()) continue;
+
+                std::ofstream os(spill_path(i),
+                                 std::ios::binary | std::ios::app);
+                os.write(reinterpret_cast<const char*>(buffer.data()),
+                         buffer.size() * sizeof(record));
+                if (!os)
+                    throw std::runtime_error("Could not write "
+                        + spill_path(i));
+
+                m_spilled[i] += buffer.size();
+                buffer.clear();
+                buffer.shrink_to_fit();
+            }
+            m_buffered = 0;
+        }
+    };
+
+    /**
+     * @brief Static minimal perfect hash function.
+     * 
+     * Maps each key of a static set to a distinct index in [0, size()), so
+     * values can be kept in a separate dense array (or an external column)
+     * with no wasted slots.
+     * 
+     * Built on chd_engine: keys hashed to the few table positions past the
+     * end are remapped onto the free positions left inside [0, size()).
+     * 
+     * @tparam Key type of key in the set.
+     * @tparam HashFamily randomized universal hash family.
+     */
+    template <
+        typename Key,
+        typename HashFamily = ru_hash_family<Key>,
+        std::enable_if_t<std::is_copy_constructible_v<Key>, int> = 0
+    > class minimal_perfect_hash {
+    public:
+        using key_type = Key;
+        using size_type = size_t;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+        using engine_type = chd_engine<key_type, hash_family>;
+
+        minimal_perfect_hash() = delete;
+        minimal_perfect_hash(const minimal_perfect_hash&) = default;
+        minimal_perfect_hash(minimal_perfect_hash&&) = default;
+
+        /**
+         * @brief Range constructor.
+         * 
+         * @tparam Iterator STL iterator for a collection of distinct keys.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         */
+        template <typename Iterator>
+        minimal_perfect_hash(Iterator first, Iterator last) {
+            hash_family family = seeded_family<hash_family>(std::nullopt);
+            populate(first, last, family);
+        }
+
+        /**
+         * @brief Range constructor with an explicit seed.
+         * 
+         * Reads no random device, and builds the same function every time it
+         * is given the same keys and seed.
+         * 
+         * @tparam Iterator STL iterator for a collection of distinct keys.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param seed Seed for construction.
+         */
+        template <typename Iterator>
+        minimal_perfect_hash(Iterator first, Iterator last, uint64_t seed) {
+            hash_family family = seeded_family<hash_family>(seed);
+            populate(first, last, family);
+        }
+
+        /**
+         * @brief Initializer list constructor.
+         * 
+         * @param keys An initializer_list object.
+         */
+        minimal_perfect_hash(const std::initializer_list<key_type>& keys)
+            : minimal_perfect_hash(keys.begin(), keys.end()) {}
+
+        minimal_perfect_hash& operator=(const minimal_perfect_hash&) = default;
+        minimal_perfect_hash& operator=(minimal_perfect_hash&&) = default;
+
+        ~minimal_perfect_hash() = default;
+
+        /**
+         * @brief Index of a key.
+         * 
+         * @param key A key in the set.
+         * @return size_type The key's index, in [0, size()).
+         * 
+         * @note If the key is not in the set, an arbitrary index is returned.
+         */
+        size_type index_of(const key_type& key) const {
+            size_type i = m_engine.slot(key);
+            return i < m_size ? i : m_remap[i - m_size];
+        }
+
+        size_type operator()(const key_type& key) const {
+            return index_of(key);
+        }
+
+        /**
+         * @brief Index of a key of a different type.
+         * 
+         * Only available if the hash function is transparent.
+         * 
+         * @see index_of(const key_type&)
+         */
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        size_type index_of(const K& key) const {
+            size_type i = m_engine.slot(key);
+            return i < m_size ? i : m_remap[i - m_size];
+        }
+
+        /**
+         * @brief Number of keys in the set.
+         */
+        size_type size() const {
+            return m_size;
+        }
+
+        /**
+         * @brief Statistics collected while the function was built.
+         */
+        const build_statistics& build_stats() const {
+            return m_stats;
+        }
+
+        /**
+         * @brief Memory used by the function, in bytes.
+         */
+        size_type memory_usage() const {
+            return sizeof(*this)
+                + m_engine.memory_usage()
+                + perfhash::memory_usage(m_remap)
+                + perfhash::memory_usage(m_stats.bucket_sizes)
+                + perfhash::memory_usage(m_stats.retries);
+        }
+    private:
+        engine_type m_engine;
+        std::vector<size_type> m_remap;
+        size_type m_size = 0;
+        build_statistics m_stats;
+
+        template <typename Iterator>
+        void populate(const Iterator& first, const Iterator& last,
+                      hash_family& family) {
+            std::vector<Iterator> keys;
+            for (auto it = first; it != last; it++) keys.push_back(it);
+            m_size = keys.size();
+
+            m_engine.build(m_size,
+                [&](size_type i) -> const auto& { return *keys[i]; },
+                family, build_options(), m_stats);
+
+            std::vector<bool> taken(m_engine.capacity());
+            for (auto& it : keys) taken[m_engine.slot(*it)] = true;
+
+            m_remap.assign(m_engine.capacity() - m_size, 0);
+            size_type free = 0;
+            for (size_type i = m_size; i < taken.size(); i++) {
+                if (!taken[i]) continue;
+                while (taken[free]) free++;
+                m_remap[i - m_size] = free++;
+            }
+        }
+    };
+
+    /**
+     * @brief Static collision-free hash set.
+     * 
+     * Keys live in a single contiguous slot array, addressed by a
+     * construction engine as in perfect_hash_map, so a lookup reads one
+     * slot. Slots holding no key are filled with a key of the set, so
+     * misses need no occupancy check either.
+     * 
+     * @tparam Key type of key in the set.
+     * @tparam HashFamily randomized universal hash family.
+     * @tparam Allocator allocator for the slot array and index, rebound to
+     *  their element types.
+     * @tparam Engine construction engine.
+     */
+    template <
+        typename Key,
+        typename HashFamily = ru_hash_family<Key>,
+        typename Allocator = std::allocator<Key>,
+        template <typename, typename> typename Engine = fks_engine,
+        std::enable_if_t<std::is_copy_constructible_v<Key>, int> = 0
+    > class perfect_hash_set {
+    public:
+        using key_type = Key;
+        using value_type = Key;
+        using size_type = size_t;
+        using allocator_type = Allocator;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+        using engine_type = Engine<key_type, hash_family>;
+
+        /**
+         * @brief Iterator over the keys of the set.
+         * 
+         * Walks the index of populated slots.
+         */
+        class const_iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Key;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Key*;
+            using reference = const Key&;
+
+            const_iterator() = default;
+
+            reference operator*() const {
+                return m_slots[*m_index];
+            }
+
+            pointer operator->() const {
+                return &m_slots[*m_index];
+            }
+
+            const_iterator& operator++() {
+                m_index++;
+                return *this;
+            }
+
+            const_iterator operator++(int) {
+                const_iterator old = *this;
+                m_index++;
+                return old;
+            }
+
+            bool operator==(const const_iterator& other) const {
+                return m_index == other.m_index;
+            }
+
+            bool operator!=(const const_iterator& other) const {
+                return m_index != other.m_index;
+            }
+        private:
+            friend class perfect_hash_set;
+
+            const Key* m_slots = nullptr;
+            const size_type* m_index = nullptr;
+
+            const_iterator(const Key* slots, const size_type* index)
+                : m_slots(slots), m_index(index) {}
+        };
+
+        using iterator = const_iterator;
+
+        perfect_hash_set() = delete;
+        perfect_hash_set(const perfect_hash_set&) = default;
+        perfect_hash_set(perfect_hash_set&&) = default;
+
+        /**
+         * @brief Range constructor.
+         * 
+         * @tparam Iterator STL iterator for a collection of distinct keys.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param allocator Allocator object.
+         */
+        template <typename Iterator>
+        perfect_hash_set(Iterator first, Iterator last,
+                         const allocator_type& allocator = allocator_type())
+            : perfect_hash_set(first, last, build_options(), allocator) {}
+
+        /**
+         * @brief Range constructor with build options.
+         * 
+         * @tparam Iterator STL iterator for a collection of distinct keys.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param options Build options (e.g. number of threads).
+         * @param allocator Allocator object.
+         * 
+         * @throw build_error If the keys can't be placed within the bounds
+         *  set by `options` (e.g. because some key is repeated), or the build
+         *  times out.
+         */
+        template <typename Iterator>
+        perfect_hash_set(Iterator first, Iterator last,
+                         const build_options& options,
+                         const allocator_type& allocator = allocator_type())
+            : m_slots(allocator), m_index(allocator) {
+            hash_family family = seeded_family<hash_family>(options.seed);
+            populate(first, last, family, options);
+        }
+
+        /**
+         * @brief Range constructor with an explicit seed.
+         * 
+         * @tparam Iterator STL iterator for a collection of distinct keys.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param seed Seed for construction (see build_options::seed).
+         * @param allocator Allocator object.
+         */
+        template <typename Iterator>
+        perfect_hash_set(Iterator first, Iterator last, uint64_t seed,
+                         const allocator_type& allocator = allocator_type())
+            : m_slots(allocator), m_index(allocator) {
+            hash_family family = seeded_family<hash_family>(seed);
+            populate(first, last, family, build_options());
+        }
+
+        /**
+         * @brief Initializer list constructor.
+         * 
+         * @param keys An initializer_list object.
+         * @param allocator Allocator object.
+         */
+        perfect_hash_set(const std::initializer_list<key_type>& keys,
+                         const allocator_type& allocator = allocator_type())
+            : perfect_hash_set(keys.begin(), keys.end(), allocator) {}
+
+        perfect_hash_set& operator=(const perfect_hash_set&) = default;
+        perfect_hash_set& operator=(perfect_hash_set&&) = default;
+
+        ~perfect_hash_set() = default;
+
+        /**
+         * @brief Checks whether the set has a key.
+         * 
+         * Compiles to selects rather than branches, as
+         * perfect_hash_map::find does, so misses cost the same as hits.
+         */
+        bool contains(const key_type& key) const noexcept {
+            return lookup(key);
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        bool contains(const K& key) const noexcept {
+            return lookup(key);
+        }
+
+        size_type count(const key_type& key) const noexcept {
+            return lookup(key);
+        }
+
+        template <typename K, typename H = hash_function,
+                  typename = typename H::is_transparent>
+        size_type count(const K& key) const noexcept {
+            return lookup(key);
+        }
+
+        /**
+         * @brief Iterator to the first key, in the order they were given.
+         * 
+         * @note Built with build_options::iterable unset, sets iterate as if
+         *  empty.
+         */
+        const_iterator begin() const {
+            return const_iterator(m_slots.data(), m_index.data());
+        }
+
+        const_iterator end() const {
+            return const_iterator(m_slots.data(),
+                                  m_index.data() + m_index.size());
+        }
+
+        /**
+         * @brief Number of keys in the set.
+         */
+        size_type size() const {
+            return m_size;
+        }
+
+        bool empty() const {
+            return m_size == 0;
+        }
+
+        allocator_type get_allocator() const {
+            return allocator_type(m_slots.get_allocator());
+        }
+
+        /**
+         * @brief Statistics collected while the set was built.
+         */
+        const build_statistics& build_stats() const {
+            return m_stats;
+        }
+
+        /**
+         * @brief Memory used by the set, in bytes.
+         * 
+         * @see perfect_hash_map::memory_usage
+         */
+        size_type memory_usage() const {
+            return sizeof(*this)
+                + m_engine.memory_usage()
+                + perfhash::memory_usage(m_slots)
+                + perfhash::memory_usage(m_index)
+                + perfhash::memory_usage(m_stats.bucket_sizes)
+                + perfhash::memory_usage(m_stats.retries);
+        }
+    private:
+        using index_allocator_type = typename std::allocator_traits<
+            allocator_type>::template rebind_alloc<size_type>;
+
+        engine_type m_engine;
+        std::vector<key_type, allocator_type> m_slots;
+        std::vector<size_type, index_allocator_type> m_index;
+        size_type m_size = 0;
+        build_statistics m_stats;
+
+        /**
+         * @brief perfect_hash_map::resolve, with keys stored in the slots.
+         */
+        template <typename K>
+        bool lookup(const K& key) const noexcept {
+            size_type i = m_engine.probe(key);
+            if (m_size == 0) return false;
+            size_type j = i == engine_type::npos ? 0 : i;
+            return (i != engine_type::npos) & (m_slots[j] == key);
+        }
+
+        template <typename Iterator>
+        void populate(const Iterator& first, const Iterator& last,
+                      hash_family& family, const build_options& options) {
+            std::pmr::vector<Iterator> keys(options.scratch_resource());
+            for (auto it = first; it != last; it++)
+                keys.push_back(it);
+            m_size = keys.size();
+
+            // Read through a const reference, so move iterators are copied
+            // from rather than emptied.
+            auto key_at = [&](size_type i) -> const key_type& {
+                return *keys[i];
+            };
+            m_engine.build(keys.size(), key_at, family, options, m_stats);
+
+            scoped_timer timer(m_stats.placement_time);
+            // Empty slots hold a copy of the first key, so an empty set gets
+            // no slots, and lookup() reads none.
+            if (keys.empty()) m_slots.clear();
+            else m_slots.assign(m_engine.capacity(), key_at(0));
+
+            if (options.iterable) m_index.resize(keys.size());
+            parallel_for(options.threads, keys.size(), [&](size_type i) {
+                size_type s = m_engine.slot(key_at(i));
+                m_slots[s] = key_at(i);
+                if (options.iterable) m_index[i] = s;
+            });
+        }
+    };
+
+    /**
+     * @brief Static string interner.
+     * 
+     * Assigns each distinct string of a static collection a dense id, in
+     * [0, size()) and in order of first appearance, and turns ids back into
+     * strings. The strings are kept back to back in a single character
+     * arena, addressed by an array of offsets, so there's no allocation per
+     * string, and key_of() is two reads.
+     * 
+     * id_of() looks the string up in a perfect_hash_map keeping only ids
+     * (see no_keys), then compares it with the string in the arena.
+     * 
+     * @tparam Id unsigned integer type of ids.
+     * @tparam HashFamily randomized universal hash family for strings.
+     * @tparam Engine construction engine.
+     */
+    template <
+        typename Id = uint32_t,
+        typename HashFamily = ru_hash_family<std::string_view>,
+        template <typename, typename> typename Engine = fks_engine
+    > class interner {
+        static_assert(std::is_unsigned_v<Id>, "ids must be unsigned");
+    public:
+        using key_type = std::string_view;
+        using id_type = Id;
+        using size_type = size_t;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+        using map_type = perfect_hash_map<key_type, id_type, hash_family,
+            std::allocator<std::pair<key_type, id_type>>, Engine, no_keys>;
+
+        /**
+         * @brief Id returned by find() for strings not interned.
+         */
+        static constexpr id_type npos = id_type(-1);
+
+        static constexpr uint32_t tag = 0x52544E49; // "INTR"
+
+        interner() = delete;
+        interner(const interner&) = default;
+        interner(interner&&) = default;
+
+        /**
+         * @brief Range constructor.
+         * 
+         * @tparam Iterator STL iterator for a collection of strings, which
+         *  may repeat, convertible to std::string_view.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param options Build options (e.g. number of threads).
+         * 
+         * @throw std::length_error If there are more distinct strings than
+         *  ids below npos.
+         * @throw build_error If the build fails or times out.
+         */
+        template <typename Iterator>
+        interner(Iterator first, Iterator last,
+                 const build_options& options = build_options())
+            : m_arena(intern(first, last, options)),
+              m_ids(index(m_arena, options)) {}
+
+        /**
+         * @brief Initializer list constructor.
+         * 
+         * @param keys An initializer_list object.
+         */
+        interner(const std::initializer_list<key_type>& keys)
+            : interner(keys.begin(), keys.end()) {}
+
+        interner& operator=(const interner&) = default;
+        interner& operator=(interner&&) = default;
+
+        ~interner() = default;
+
+        /**
+         * @brief Id of a string.
+         * 
+         * @throw std::out_of_range If the string was not interned.
+         */
+        id_type id_of(key_type key) const {
+            id_type id = find(key);
+            if (id == npos) throw std::out_of_range("No such key");
+            return id;
+        }
+
+        /**
+         * @brief Id of a string, or npos if it was not interned.
+         */
+        id_type find(key_type key) const noexcept {
+            const id_type* id = m_ids.find(key);
+            return id && m_arena.key(*id) == key ? *id : npos;
+        }
+
+        bool contains(key_type key) const noexcept {
+            return find(key) != npos;
+        }
+
+        /**
+         * @brief Batched find().
+         * 
+         * @see perfect_hash_map::find_many
+         */
+        void find_many(const key_type* keys, size_type n,
+                       id_type* out) const {
+            const id_type* ids[batch_size];
+            for (size_type base = 0; base < n; base += batch_size) {
+                size_type m = std::min(batch_size, n - base);
+                m_ids.find_many(keys + base, m, ids);
+                for (size_type i = 0; i < m; i++)
+                    out[base + i] = ids[i]
+                            && m_arena.key(*ids[i]) == keys[base + i]
+                        ? *ids[i] : npos;
+            }
+        }
+
+        /**
+         * @brief String with an id.
+         * 
+         * @param id An id in [0, size()).
+         * @return key_type The string, in the arena.
+         * 
+         * @note If the id is out of range, the behavior is undefined.
+         */
+        key_type key_of(id_type id) const noexcept {
+            assert(id < size());
+            return m_arena.key(id);
+        }
+
+        /**
+         * @brief Number of distinct strings.
+         */
+        size_type size() const {
+            return m_arena.offsets.size() - 1;
+        }
+
+        /**
+         * @brief Statistics collected while the id map was built.
+         */
+        const build_statistics& build_stats() const {
+            return m_ids.build_stats();
+        }
+
+        /**
+         * @brief Memory used by the interner, in bytes.
+         */
+        size_type memory_usage() const {
+            return sizeof(*this) - sizeof(m_ids)
+                + m_ids.memory_usage()
+                + perfhash::memory_usage(m_arena.offsets)
+                + perfhash::memory_usage(m_arena.chars);
+        }
+
+        /**
+         * @brief Writes the interner to a binary stream.
+         * 
+         * The id map is written as perfect_hash_map::save writes it, and
+         * followed by the arena, so interner_view can query the result in
+         * place.
+         * 
+         * @param os Output stream, opened in binary mode.
+         * 
+         * @throw std::runtime_error If writing fails.
+         */
+        void save(std::ostream& os) const {
+            binary_writer writer(os);
+            writer.write(header());
+            m_ids.save(writer);
+            writer.write_array(m_arena.offsets.data(), m_arena.offsets.size());
+            writer.write_array(m_arena.chars.data(), m_arena.chars.size());
+        }
+
+        /**
+         * @brief Writes the interner to a file.
+         * 
+         * @param path Path to the file, which is overwritten.
+         * 
+         * @throw std::runtime_error If writing fails.
+         * @see save(std::ostream&)
+         */
+        void save(const std::string& path) const {
+            std::ofstream os(path, std::ios::binary | std::ios::trunc);
+            if (!os) throw std::runtime_error("Could not open " + path);
+            save(os);
+        }
+
+        /**
+         * @brief Header identifying files written by save().
+         */
+        static file_header header() {
+            file_header header;
+            header.engine = tag;
+            header.hash_size = sizeof(hash_function);
+            header.value_size = sizeof(id_type);
+            return header;
+        }
+    private:
+        /**
+         * @brief Strings back to back, with string i in
+         *  [offsets[i], offsets[i + 1]).
+         */
+        struct string_arena {
+            std::vector<uint64_t> offsets;
+            std::vector<char> chars;
+
+            key_type key(size_type i) const noexcept {
+                return key_type(chars.data() + offsets[i],
+                                size_type(offsets[i + 1] - offsets[i]));
+            }
+        };
+
+        static constexpr size_type batch_size = 32;
+
+        string_arena m_arena;
+        map_type m_ids;
+
+        /**
+         * @brief Copies the distinct strings of a range to an arena.
+         */
+        template <typename Iterator>
+        static string_arena intern(const Iterator& first,
+                                   const Iterator& last,
+                                   const build_options& options) {
+            hash_function hash = seeded_family<hash_family>(options.seed)
+                .sample(hash_function::w);
+
+            string_arena arena;
+            arena.offsets.push_back(0);
+            std::vector<std::pair<hash_t, size_type>> order;
+            for (auto it = first; it != last; it++) {
+                const auto& value = *it;
+                key_type key(value);
+                order.emplace_back(hash(key), order.size());
+                arena.chars.insert(arena.chars.end(), key.begin(), key.end());
+                arena.offsets.push_back(arena.chars.size());
+            }
+            std::sort(order.begin(), order.end());
+
+            // Within a run of equal hashes, later copies of a string are
+            // dropped by its first copy, which comes first in the run.
+            std::vector<bool> dropped(order.size(), false);
+            for (size_type i = 0; i < order.size(); i++) {
+                size_type a = order[i].second;
+                if (dropped[a]) continue;
+                for (size_type j = i + 1;
+                        j < order.size() && order[j].first == order[i].first;
+                        j++) {
+                    size_type b = order[j].second;
+                    if (!dropped[b] && arena.key(a) == arena.key(b))
+                        dropped[b] = true;
+                }
+            }
+
+            // Compacts in place: strings only ever move towards the front.
+            size_type kept = 0;
+            for (size_type i = 0; i < order.size(); i++) {
+                if (dropped[i]) continue;
+                uint64_t begin = arena.offsets[i];
+                uint64_t length = arena.offsets[i + 1] - begin;
+                uint64_t end = arena.offsets[kept];
+                if (length > 0)
+                    std::memmove(arena.chars.data() + end,
+                                 arena.chars.data() + begin, length);
+                arena.offsets[++kept] = end + length;
+            }
+            if (kept >= npos)
+                throw std::length_error("Too many strings for the id type");
+
+            arena.chars.resize(arena.offsets[kept]);
+            arena.chars.shrink_to_fit();
+            arena.offsets.resize(kept + 1);
+            arena.offsets.shrink_to_fit();
+            return arena;
+        }
+
+        /**
+         * @brief Builds the map from the strings of an arena to their ids.
+         */
+        static map_type index(const string_arena& arena,
+                              const build_options& options) {
+            std::vector<std::pair<key_type, id_type>> elements;
+            elements.reserve(arena.offsets.size() - 1);
+            for (size_type i = 0; i + 1 < arena.offsets.size(); i++)
+                elements.emplace_back(arena.key(i), id_type(i));
+            return map_type(std::move(elements), options);
+        }
+    };
+
+    /**
+     * @brief Read-only view of a serialized interner.
+     * 
+     * Answers queries directly on the bytes written by interner::save,
+     * typically memory-mapped from a file, without deserializing or
+     * allocating anything.
+     * 
+     * @tparam Id unsigned integer type of ids.
+     * @tparam HashFamily randomized universal hash family for strings.
+     * @tparam Engine construction engine.
+     */
+    template <
+        typename Id = uint32_t,
+        typename HashFamily = ru_hash_family<std::string_view>,
+        template <typename, typename> typename Engine = fks_engine
+    > class interner_view {
+    public:
+        using key_type = std::string_view;
+        using id_type = Id;
+        using size_type = size_t;
+        using interner_type = interner<Id, HashFamily, Engine>;
+
+        static constexpr id_type npos = interner_type::npos;
+
+        /**
+         * @brief Views a serialized interner held in memory.
+         * 
+         * @param data Serialized interner, aligned to
+         *  binary_writer::alignment. It must outlive the view.
+         * @param size Size of the data, in bytes.
+         * 
+         * @throw std::runtime_error If the data was not written by a
+         *  compatible interner.
+         */
+        interner_view(const void* data, size_type size)
+            : interner_view(binary_reader(static_cast<const char*>(data),
+                                          size)) {}
+
+#if defined(__unix__) || defined(__APPLE__)
+        /**
+         * @brief Memory-maps a file written by interner::save.
+         * 
+         * @param path Path to the file.
+         * 
+         * @throw std::runtime_error If the file can't be mapped or was not
+         *  written by a compatible interner.
+         */
+        explicit interner_view(const std::string& path)
+            : interner_view(std::make_shared<mapped_file>(path)) {}
+#endif
+
+        /**
+         * @see interner::id_of
+         */
+        id_type id_of(key_type key) const {
+            id_type id = find(key);
+            if (id == npos) throw std::out_of_range("No such key");
+            return id;
+        }
+
+        /**
+         * @see interner::find
+         */
+        id_type find(key_type key) const noexcept {
+            const id_type* id = m_ids.find(key);
+            return id && *id < size() && key_of(*id) == key ? *id : npos;
+        }
+
+        bool contains(key_type key) const noexcept {
+            return find(key) != npos;
+        }
+
+        /**
+         * @see interner::key_of
+         */
+        key_type key_of(id_type id) const noexcept {
+            assert(id < size());
+            return key_type(m_chars + m_offsets[id],
+                            size_type(m_offsets[id + 1] - m_offsets[id]));
+        }
+
+        size_type size() const {
+            return m_size;
+        }
+    private:
+        using ids_view_type = perfect_hash_map_view<key_type, id_type,
+            HashFamily, Engine, no_keys>;
+
+#if defined(__unix__) || defined(__APPLE__)
+        std::shared_ptr<const mapped_file> m_file;
+
+        explicit interner_view(std::shared_ptr<const mapped_file> file)
+            : interner_view(binary_reader(file->data(), file->size())) {
+            m_file = std::move(file);
+        }
+#endif
+        ids_view_type m_ids;
+        const uint64_t* m_offsets = nullptr;
+        const char* m_chars = nullptr;
+        size_type m_size = 0;
+
+        explicit interner_view(binary_reader&& reader)
+            : m_ids(check_header(reader)) {
+            size_type offset_count, char_count;
+            m_offsets = reader.read_array<uint64_t>(offset_count);
+            m_chars = reader.read_array<char>(char_count);
+            if (offset_count == 0 || m_offsets[0] != 0
+                    || m_offsets[offset_count - 1] != char_count)
+                throw std::runtime_error("Malformed perfect hash");
+            // Non-decreasing offsets ending at char_count stay within it.
+            for (size_type i = 1; i < offset_count; i++)
+                if (m_offsets[i] < m_offsets[i - 1])
+                    throw std::runtime_error("Malformed perfect hash");
+            m_size = offset_count - 1;
+        }
+
+        static binary_reader& check_header(binary_reader& reader) {
+            if (!(reader.read<file_header>() == interner_type::header()))
+                throw std::runtime_error("Incompatible perfect hash");
+            return reader;
+        }
+    };
+
+    /**
+     * @brief Static hash map laid out in cache-line blocks.
+     * 
+     * Every first-level bucket is a 64-byte block holding a 16-byte header
+     * and as many slots as fit in the rest of the line, so looking up a key
+     * whose bucket fits reads a single cache line. Buckets with more keys
+     * than that keep their slots in an overflow table, sized as fks_engine
+     * would size them. The block array is backed by huge pages when it is
+     * large enough (see build_options::huge_pages).
+     * 
+     * Both levels are addressed from a single hash of the key: its high bits
+     * pick the block, and a remix of it with the block's seed picks the slot.
+     * Empty slots hold a key stored elsewhere in the map, as in
+     * perfect_hash_map, so lookups need no occupancy check.
+     * 
+     * @tparam Key type of key used in the map.
+     * @tparam Value type of value stored in the map.
+     * @tparam HashFamily randomized universal hash family.
+     */
+    template <
+        typename Key,
+        typename Value,
+        typename HashFamily = ru_hash_family<Key>
+    > class blocked_perfect_hash_map {
+        static_assert(std::is_trivially_copyable_v<Key>
+                && std::is_trivially_copyable_v<Value>,
+            "blocked maps only hold trivially copyable keys and values");
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using value_type = std::pair<key_type, mapped_type>;
+        using size_type = size_t;
+        using reference = Value&;
+        using const_reference = const Value&;
+        using hash_family = HashFamily;
+        using hash_function = typename hash_family::hash_function;
+
+        static constexpr size_type block_size = 64;
+
+        blocked_perfect_hash_map() = delete;
+        blocked_perfect_hash_map(const blocked_perfect_hash_map&) = default;
+        blocked_perfect_hash_map(blocked_perfect_hash_map&&) = default;
+
+        /**
+         * @brief Range constructor.
+         * 
+         * @tparam Iterator STL iterator for a collection type.
+         * @param first Iterator to the initial position in a range.
+         * @param last Iterator to the final position in a range.
+         * @param options Build options. The load factor is the mean number
+         *  of keys per block.
+         * 
+         * @throw std::invalid_argument If a load factor is not positive.
+         * @throw build_error If no function could be found after repeatedly
+         *  drawing new ones (e.g. the range has duplicate keys), or the build
+         *  times out.
+         */
+        template <typename Iterator>
+        blocked_perfect_hash_map(Iterator first, Iterator last,
+                const build_options& options = build_options()) {
+            hash_family family = seeded_family<hash_family>(options.seed);
+            populate(first, last, family, options);
+        }
+
+        /**
+         * @brief Initializer list constructor.
+         * 
+         * @param values An initializer_list object.
+         */
+        blocked_perfect_hash_map(
+                const std::initializer_list<value_type>& values)
+            : blocked_perfect_hash_map(values.begin(), values.end()) {}
+
+        blocked_perfect_hash_map& operator=(
+            const blocked_perfect_hash_map& other) = default;
+        blocked_perfect_hash_map& operator=(
+            blocked_perfect_hash_map&& other) = default;
+
+        /**
+         * @brief Element lookup without exceptions.
+         * 
+         * @return const mapped_type* Pointer to the mapped value, or nullptr
+         *  if there's no matching key in the container.
+         * @see perfect_hash_map::find
+         */
+        const mapped_type* find(const key_type& key) const noexcept {
+            const slot& s = slot_of(m_hash(key));
+            return (m_size != 0) & (s.key == key) ? &s.value : nullptr;
+        }
+
+        mapped_type* find(const key_type& key) noexcept {
+            slot& s = slot_of(m_hash(key));
+            return (m_size != 0) & (s.key == key) ? &s.value : nullptr;
+        }
+
+        bool contains(const key_type& key) const noexcept {
+            return find(key) != nullptr;
+        }
+
+        /**
+         * @brief Safe access element.
+         * 
+         * @throw std::out_of_range If there's no matching key in the
+         *  container.
+         */
+        const_reference at(const key_type& key) const {
+            const mapped_type* value = find(key);
+            if (!value) throw std::out_of_range("No such key");
+            return *value;
+        }
+
+        reference at(const key_type& key) {
+            mapped_type* value = find(key);
+            if (!value) throw std::out_of_range("No such key");
+            return *value;
+        }
+
+        /**
+         * @brief Access element.
+         * 
+         * @note If the container has no matching key, this operator returns
+         *  an arbitrary value.
+         */
+        const_reference operator[](const key_type& key) const {
+            return slot_of(m_hash(key)).value;
+        }
+
+        reference operator[](const key_type& key) {
+            return slot_of(m_hash(key)).value;
+        }
+
+        size_type size() const {
+            return m_size;
+        }
+
+        bool empty() const {
+            return m_size == 0;
+        }
+
+        /**
+         * @brief Statistics collected while the container was built.
+         */
+        const build_statistics& build_stats() const {
+            return m_stats;
+        }
+
+        /**
+         * @brief Memory used by the container, in bytes.
+         */
+        size_type memory_usage() const {
+            return sizeof(*this)
+                + m_blocks.capacity()
+                + perfhash::memory_usage(m_overflow)
+                + perfhash::memory_usage(m_stats.bucket_sizes)
+                + perfhash::memory_usage(m_stats.retries);
+        }
+    private:
+        struct slot {
+            Key key;
+            Value value;
+        };
+
+        static constexpr size_type header_size = 16;
+        static constexpr size_type inline_slots =
+            (block_size - header_size) / sizeof(slot);
+        static_assert(inline_slots > 0, "elements too large to be blocked");
+
+        /**
+         * @brief First-level bucket.
+         * 
+         * The bucket's table holds `size` slots: the inline ones if it fits
+         * in them, otherwise `size` overflow slots starting at `offset`.
+         */
+        struct alignas(block_size) block {
+            uint32_t seed;
+            uint32_t size;
+            uint64_t offset;
+            slot slots[inline_slots];
+        };
+        static_assert(sizeof(block) == block_size,
+            "elements must pack into a cache line");
+
+        static constexpr unsigned max_attempts = 64;
+
+        hash_function m_hash;
+        page_buffer m_blocks;
+        size_type m_block_count = 0;
+        std::vector<slot> m_overflow;
+        size_type m_size = 0;
+        build_statistics m_stats;
+
+        const block* blocks() const {
+            return static_cast<const block*>(m_blocks.data());
+        }
+
+        block* blocks() {
+            return static_cast<block*>(m_blocks.data());
+        }
+
+        static size_type position(const block& b, uint64_t h) {
+            return size_type(reduce(mix64(h ^ b.seed), b.size));
+        }
+
+        /**
+         * @brief Slot a key with hash `h` would occupy.
+         * 
+         * Empty blocks have size zero, so they resolve to their first inline
+         * slot, which is never a match.
+         */
+        const slot& slot_of(uint64_t h) const {
+            const block& b = blocks()[reduce(h, m_block_count)];
+            size_type i = position(b, h);
+            return b.size <= inline_slots
+                ? b.slots[i] : m_overflow[b.offset + i];
+        }
+
+        slot& slot_of(uint64_t h) {
+            return const_cast<slot&>(
+                static_cast<const blocked_perfect_hash_map*>(this)->slot_of(h));
+        }
+
+        /**
+         * @brief Table size a block of `l` keys starts with.
+         */
+        static size_type table_size(size_type l,
+                                    const build_options& options) {
+            if (l == 0) return 0;
+            if (l <= inline_slots) return inline_slots;
+            return std::max(l, size_type(std::ceil(
+                options.secondary_scale * double(l) * double(l))));
+        }
+
+        /**
+         * @brief Draws seeds until a block's hashes don't collide.
+         * 
+         * Checks for collisions, and grows tables that exhaust `budget`, as
+         * fks_engine::do_perfect does. A block outgrowing its inline slots
+         * moves to the overflow table.
+         * 
+         * @param taken Empty slot set, left empty.
+         * @return size_type Number of retries needed.
+         * 
+         * @throw build_error If the table can't grow any further, or the
+         *  deadline passes.
+         */
+        template <typename RNG>
+        static size_type search(block& b, const uint64_t* first,
+                                const uint64_t* last, RNG& rng,
+                                slot_set& taken, size_type budget,
+                                const build_deadline& deadline) {
+            size_type l = size_type(last - first);
+            size_type limit = std::min(
+                std::max(size_type(b.size), 4 * l * l),
+                size_type(UINT32_MAX));
+            size_type slots[all_distinct_limit];
+            taken.resize(b.size, l);
+            for (size_type retries = 0;; retries++) {
+                if (retries > 0 && retries % 64 == 0) deadline.check();
+                if (retries > 0 && retries % budget == 0) {
+                    if (b.size >= limit)
+                        throw build_error("Could not build perfect hash");
+                    b.size = uint32_t(std::min(2 * size_type(b.size), limit));
+                    taken.resize(b.size, l);
+                }
+                b.seed = uint32_t(rng());
+
+                if (l <= all_distinct_limit) {
+                    for (size_type i = 0; i < l; i++)
+                        slots[i] = position(b, first[i]);
+                    if (all_distinct(slots, l)) return retries;
+                    continue;
+                }
+
+                auto it = first;
+                while (it != last && taken.insert(position(b, *it))) it++;
+                taken.clear();
+                if (it == last) return retries;
+            }
+        }
+
+        template <typename Iterator>
+        void populate(const Iterator& first, const Iterator& last,
+                      hash_family& family, const build_options& options) {
+            if (!(options.load_factor > 0) || !(options.secondary_scale > 0))
+                throw std::invalid_argument("Load factors must be positive");
+            if (options.retry_budget == 0)
+                throw std::invalid_argument("Retry budget must be positive");
+
+            std::pmr::monotonic_buffer_resource arena(
+                options.scratch_resource());
+            std::pmr::vector<Iterator> elements(&arena);
+            for (auto it = first; it != last; it++)
+                elements.push_back(it);
+            size_type n = m_size = elements.size();
+            m_block_count = std::max(size_type(1),
+                size_type(std::ceil(n / options.load_factor)));
+
+            // Keys are told apart within a block by their full hash, so a
+            // function giving two keys of a block the same hash is dropped.
+            std::pmr::vector<uint64_t> hashes(n, &arena);
+            std::pmr::vector<size_type> start(m_block_count + 1, &arena);
+            std::pmr::vector<uint64_t> sorted(n, &arena);
+            build_deadline deadline(options);
+            for (unsigned attempt = 0;; attempt++) {
+                if (attempt == max_attempts)
+                    throw build_error("Could not build perfect hash");
+                deadline.check();
+
+                scoped_timer timer(m_stats.partition_time);
+                m_hash = family.sample(hash_function::w);
+                parallel_for(options.threads, n, [&](size_type i) {
+                    hashes[i] = m_hash(elements[i]->first);
+                });
+
+                std::fill(start.begin(), start.end(), 0);
+                for (uint64_t h : hashes) start[reduce(h, m_block_count) + 1]++;
+                std::partial_sum(start.begin(), start.end(), start.begin());
+
+                std::pmr::vector<size_type> cursor(start.begin(),
+                                                   start.end() - 1, &arena);
+                for (uint64_t h : hashes)
+                    sorted[cursor[reduce(h, m_block_count)]++] = h;
+
+                bool distinct = true;
+                for (size_type b = 0; b < m_block_count && distinct; b++) {
+                    auto lo = sorted.begin() + start[b];
+                    auto hi = sorted.begin() + start[b + 1];
+                    std::sort(lo, hi);
+                    distinct = std::adjacent_find(lo, hi) == hi;
+                }
+                if (distinct) {
+                    m_stats.restarts = attempt;
+                    break;
+                }
+            }
+
+            m_blocks = page_buffer(m_block_count * sizeof(block),
+                                   options.huge_pages);
+            block* table = blocks();
+            std::uninitialized_value_construct_n(table, m_block_count);
+
+            size_type largest = 1, longest = 0;
+            for (size_type b = 0; b < m_block_count; b++) {
+                size_type l = start[b + 1] - start[b];
+                size_type size = table_size(l, options);
+                table[b].size = uint32_t(size);
+                largest = std::max(largest, size);
+                longest = std::max(longest, l);
+            }
+
+            std::pmr::vector<size_type> retries(m_block_count, 0, &arena);
+            {
+                scoped_timer timer(m_stats.search_time);
+                std::vector<slot_set> sets(worker_count(options.threads,
+                                                        m_block_count));
+                for (slot_set& set : sets) set.resize(largest, longest);
+                uint64_t salt = family.rng();
+
+                parallel_for(options.threads, m_block_count,
+                    [&](size_type b, unsigned worker) {
+                        if (start[b] == start[b + 1]) return;
+
+                        splitmix64 rng(mix64(salt + b));
+                        retries[b] = search(table[b], &sorted[start[b]],
+                            &sorted[start[b + 1]], rng, sets[worker],
+                            options.retry_budget, deadline);
+                    });
+            }
+
+            // Overflow tables are only laid out once searched, since a block
+            // that exhausts its retry budget grows its table.
+            size_type overflow = 0;
+            for (size_type b = 0; b < m_block_count; b++) {
+                size_type l = start[b + 1] - start[b];
+                if (table[b].size > table_size(l, options))
+                    m_stats.grown_buckets++;
+                if (table[b].size <= inline_slots) continue;
+                table[b].offset = overflow;
+                overflow += table[b].size;
+            }
+
+            scoped_timer timer(m_stats.placement_time);
+            slot vacant{};
+            if (n > 0) vacant.key = elements[0]->first;
+            for (size_type b = 0; b < m_block_count; b++)
+                std::fill(std::begin(table[b].slots), std::end(table[b].slots),
+                          vacant);
+            m_overflow.assign(overflow, vacant);
+
+            parallel_for(options.threads, n, [&](size_type i) {
+                slot& s = slot_of(hashes[i]);
+                s.key = elements[i]->first;
+                s.value = elements[i]->second;
+            });
+
+            m_stats.keys = n;
+            m_stats.buckets = m_block_count;
+            m_stats.slots = m_block_count * inline_slots + overflow;
+            m_stats.metadata = sizeof(m_hash) + m_block_count * header_size;
+            for (size_type b = 0; b < m_block_count; b++)
+                m_stats.add_bucket(start[b + 1] - start[b], retries[b]);
+        }
+    };
+
+    /**
+     * @brief Hash used by static_perfect_hash_map, evaluable at compile time.
+     * 
+     * Integers and enums hash to themselves; the table's multiplier does the
+     * mixing. Strings are folded byte by byte (FNV-1a).
+     */
+    template <typename Key, typename Enable = void>
+    struct static_hash;
+
+    template <typename Key>
+    struct static_hash<Key, std::enable_if_t<
+        std::is_integral_v<Key> || std::is_enum_v<Key>>> {
+        constexpr uint64_t operator()(Key key) const {
+            return uint64_t(key);
+        }
+    };
+
+    template <>
+    struct static_hash<std::string_view> {
+        constexpr uint64_t operator()(std::string_view key) const {
+            uint64_t h = 0xCBF29CE484222325ULL;
+            for (char c : key) h = (h ^ uint8_t(c)) * 0x100000001B3ULL;
+            return h;
+        }
+    };
+
+    /**
+     * @brief Perfect hash map over a key set fixed at compile time.
+     * 
+     * Built by make_static_perfect_hash(), typically into a constexpr
+     * variable, so the search for a perfect function happens during
+     * constant evaluation and the table lives in read-only data, with no
+     * startup cost or heap use.
+     * 
+     * The builder first looks for a multiplier `a` making
+     * `(a * hash(key)) >> shift` collision-free on its own; lookups are then
+     * a multiply, a shift and one load. That quickly succeeds for a few
+     * dozen keys, given that the table has 2 to 4 slots per key. Larger sets
+     * fall back to hash-and-displace, as in chd_engine, which adds one load
+     * from a small pilot array.
+     * 
+     * @tparam Key key type: an integer, an enum or std::string_view.
+     * @tparam Value mapped type, default constructible and literal.
+     * @tparam N number of keys.
+     */
+    template <typename Key, typename Value, size_t N>
+    class static_perfect_hash_map {
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using size_type = size_t;
+        using pilot_type = uint16_t;
+
+        static constexpr size_type capacity = 2 * ceil_pow2(N);
+        static constexpr size_type bucket_count =
+            ceil_pow2(N) > 1 ? ceil_pow2(N) / 2 : 1;
+
+        /**
+         * @brief Builds the table, at compile time if used in a constant
+         *  expression.
+         * 
+         * @throw build_error If no perfect function is found, e.g. because
+         *  of duplicate keys. In a constant expression, this makes
+         *  compilation fail instead.
+         */
+        constexpr explicit static_perfect_hash_map(
+                const std::array<std::pair<Key, Value>, N>& elements) {
+            splitmix64 rng(N);
+            for (unsigned attempt = 0; attempt < direct_attempts; attempt++) {
+                m_multiplier = rng() | 1;
+                if (place_direct(elements)) return;
+            }
+
+            m_displaced = true;
+            for (unsigned attempt = 0; attempt < displaced_attempts;
+                    attempt++) {
+                m_multiplier = rng() | 1;
+                if (place_displaced(elements)) return;
+            }
+            throw build_error("Could not build perfect hash");
+        }
+
+        /**
+         * @brief Pointer to the value mapped to a key, or nullptr if there's
+         *  no matching key.
+         */
+        constexpr const mapped_type* find(const key_type& key) const noexcept {
+            const slot& s = m_slots[slot_of(key)];
+            return s.used && s.key == key ? &s.value : nullptr;
+        }
+
+        constexpr bool contains(const key_type& key) const noexcept {
+            return find(key) != nullptr;
+        }
+
+        /**
+         * @brief Safe access element.
+         * 
+         * @throw std::out_of_range If there's no matching key.
+         */
+        constexpr const mapped_type& at(const key_type& key) const {
+            const mapped_type* value = find(key);
+            if (!value) throw std::out_of_range("No such key");
+            return *value;
+        }
+
+        /**
+         * @brief Access element.
+         * 
+         * @note If there's no matching key, this operator returns an
+         *  arbitrary value.
+         */
+        constexpr const mapped_type& operator[](const key_type& key) const {
+            return m_slots[slot_of(key)].value;
+        }
+
+        constexpr size_type size() const {
+            return N;
+        }
+
+        /**
+         * @brief Whether lookups go through the pilot array.
+         */
+        constexpr bool displaced() const {
+            return m_displaced;
+        }
+    private:
+        struct slot {
+            Key key{};
+            Value value{};
+            bool used = false;
+        };
+
+        static constexpr unsigned int slot_bits = log2(capacity - 1);
+        static constexpr unsigned int bucket_bits = log2(bucket_count - 1);
+        static constexpr unsigned direct_attempts = 256;
+        static constexpr unsigned displaced_attempts = 16;
+        static constexpr uint64_t max_pilot = pilot_type(-1);
+
+        uint64_t m_multiplier = 0;
+        bool m_displaced = false;
+        std::array<pilot_type, bucket_count> m_pilots{};
+        std::array<slot, capacity> m_slots{};
+
+        constexpr uint64_t scramble(const key_type& key) const {
+            return static_hash<key_type>()(key) * m_multiplier;
+        }
+
+        static constexpr size_type position(uint64_t f, uint64_t pilot) {
+            return size_type(((f ^ (pilot * 0x9E3779B97F4A7C15ULL))
+                * 0xBF58476D1CE4E5B9ULL) >> (64 - slot_bits));
+        }
+
+        static constexpr size_type bucket(uint64_t f) {
+            return bucket_bits == 0 ? 0 : size_type(f >> (64 - bucket_bits));
+        }
+
+        constexpr size_type slot_of(const key_type& key) const {
+            uint64_t f = scramble(key);
+            if (!m_displaced) return size_type(f >> (64 - slot_bits));
+            return position(f, m_pilots[bucket(f)]);
+        }
+
+        constexpr bool place_direct(
+                const std::array<std::pair<Key, Value>, N>& elements) {
+            m_slots = {};
+            for (const auto& [key, value] : elements) {
+                slot& s = m_slots[size_type(scramble(key) >> (64 - slot_bits))];
+                if (s.used) return false;
+                s = slot{ key, value, true };
+            }
+            return true;
+        }
+
+        constexpr bool place_displaced(
+                const std::array<std::pair<Key, Value>, N>& elements) {
+            m_slots = {};
+            m_pilots = {};
+
+            // Counting sort of the elements by bucket.
+            std::array<size_type, bucket_count + 1> start{};
+            for (const auto& element : elements)
+                start[bucket(scramble(element.first)) + 1]++;
+            size_type largest = 0;
+            for (size_type b = 0; b < bucket_count; b++) {
+                largest = std::max(largest, start[b + 1]);
+                start[b + 1] += start[b];
+            }
+            std::array<size_type, bucket_count> cursor{};
+            for (size_type b = 0; b < bucket_count; b++) cursor[b] = start[b];
+            std::array<size_type, N> order{};
+            for (size_type i = 0; i < N; i++)
+                order[cursor[bucket(scramble(elements[i].first))]++] = i;
+
+            // Largest buckets first, while the table is still mostly empty.
+            for (size_type l = largest; l > 0; l--) {
+                for (size_type b = 0; b < bucket_count; b++) {
+                    if (start[b + 1] - start[b] != l) continue;
+                    if (!displace(elements, b, &order[0] + start[b],
+                                  &order[0] + start[b + 1]))
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        constexpr bool displace(
+                const std::array<std::pair<Key, Value>, N>& elements,
+                size_type b, const size_type* first, const size_type* last) {
+            for (uint64_t pilot = 0; pilot <= max_pilot; pilot++) {
+                const size_type* it = first;
+                for (; it != last; it++) {
+                    const auto& [key, value] = elements[*it];
+                    slot& s = m_slots[position(scramble(key), pilot)];
+                    if (s.used) break;
+                    s = slot{ key, value, true };
+                }
+                if (it == last) {
+                    m_pilots[b] = pilot_type(pilot);
+                    return true;
+                }
+                for (const size_type* undo = first; undo != it; undo++)
+                    m_slots[position(scramble(elements[*undo].first), pilot)]
+                        = slot{};
+            }
+            return false;
+        }
+    };
+
+    /**
+     * @brief Builds a static_perfect_hash_map.
+     * 
+     * e.g. `constexpr auto ops = make_static_perfect_hash(std::array{
+     * std::pair{"add"sv, 1}, std::pair{"sub"sv, 2}});`
+     */
+    template <typename Key, typename Value, size_t N>
+    constexpr static_perfect_hash_map<Key, Value, N> make_static_perfect_hash(
+            const std::array<std::pair<Key, Value>, N>& elements) {
+        return static_perfect_hash_map<Key, Value, N>(elements);
+    }
+
+    /**
+     * @brief Container shared by lock-free readers and a rebuilding writer.
+     * 
+     * Holds an immutable map, typically a perfect_hash_map, behind an atomic
+     * pointer. Writers build a new map aside and publish() it, which swaps
+     * it in atomically; the old map is destroyed once no reader can still be
+     * using it.
+     * 
+     * Reclamation is epoch based. A reader claims one of a fixed number of
+     * cache-line-sized slots, preferring one picked from its thread id, and
+     * stamps it with the current epoch while it holds a snapshot. Publishing
+     * advances the epoch and retires the old map; retired maps are destroyed
+     * when every claimed slot carries a later epoch. Readers never lock and
+     * never touch a shared reference count, only their own slot.
+     * 
+     * @tparam Map type of the published map.
+     */
+    template <typename Map>
+    class concurrent_perfect_hash_map {
+        struct reader_slot;
+    public:
+        using map_type = Map;
+        using key_type = typename map_type::key_type;
+        using mapped_type = typename map_type::mapped_type;
+        using size_type = size_t;
+
+        /**
+         * @brief Read access to the map published at the time it was taken.
+         * 
+         * The map stays alive, and unchanged, until the snapshot is
+         * destroyed. Snapshots should be short-lived: while one is held,
+         * maps retired after it was taken can't be reclaimed.
+         */
+        class snapshot {
+        public:
+            snapshot(const snapshot&) = delete;
+            snapshot& operator=(const snapshot&) = delete;
+
+            snapshot(snapshot&& other) noexcept
+                : m_slot(other.m_slot), m_map(other.m_map) {
+                other.m_slot = nullptr;
+            }
+
+            ~snapshot() {
+                if (m_slot) m_slot->epoch.store(0, std::memory_order_release);
+            }
+
+            const map_type& operator*() const {
+                return *m_map;
+            }
+
+            const map_type* operator->() const {
+                return m_map;
+            }
+        private:
+            friend class concurrent_perfect_hash_map;
+
+            reader_slot* m_slot;
+            const map_type* m_map;
+
+            snapshot(reader_slot* slot, const map_type* map)
+                : m_slot(slot), m_map(map) {}
+        };
+
+        /**
+         * @brief Publishes an initial map.
+         * 
+         * @param map The map.
+         * @param reader_slots How many readers can hold snapshots at once
+         *  without waiting for each other. Zero means twice the number of
+         *  hardware threads, but at least 64.
+         */
+        explicit concurrent_perfect_hash_map(map_type map,
+                                             size_type reader_slots = 0)
+            : m_current(new map_type(std::move(map))) {
+            if (reader_slots == 0)
+                reader_slots = std::max<size_type>(
+                    64, 2 * std::thread::hardware_concurrency());
+            m_slot_count = reader_slots;
+            m_slots.reset(new reader_slot[m_slot_count]);
+        }
+
+        concurrent_perfect_hash_map(const concurrent_perfect_hash_map&) = delete;
+        concurrent_perfect_hash_map& operator=(
+            const concurrent_perfect_hash_map&) = delete;
+
+        /**
+         * @brief Destroys the published map and every retired one.
+         * 
+         * @note No snapshot may outlive the container.
+         */
+        ~concurrent_perfect_hash_map() {
+            delete m_current.load();
+            for (auto& retired : m_retired) delete retired.first;
+        }
+
+        /**
+         * @brief Takes a snapshot of the published map.
+         * 
+         * Lock-free; waits only if every reader slot is taken.
+         */
+        snapshot read() const {
+            uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+            size_type i = thread_hint() % m_slot_count;
+            for (;; i = (i + 1) % m_slot_count) {
+                uint64_t expected = 0;
+                if (m_slots[i].epoch.compare_exchange_weak(expected, epoch))
+                    break;
+            }
+            return snapshot(&m_slots[i], m_current.load());
+        }
+
+        /**
+         * @brief Safe access element.
+         * 
+         * @return mapped_type A copy of the mapped value, since the map it
+         *  lives in can be retired as soon as this returns.
+         * 
+         * @throw std::out_of_range If there's no matching key in the
+         *  published map.
+         */
+        mapped_type at(const key_type& key) const {
+            return read()->at(key);
+        }
+
+        /**
+         * @brief Checks whether the published map has an element with a key.
+         */
+        bool contains(const key_type& key) const {
+            return read()->contains(key);
+        }
+
+        /**
+         * @brief Atomically replaces the published map.
+         * 
+         * Readers holding snapshots keep using the old map, which is
+         * destroyed by this or a later call to publish() or reclaim() once
+         * they are done. Concurrent writers are serialized.
+         * 
+         * @param map The new map.
+         */
+        void publish(map_type map) {
+            auto next = std::make_unique<map_type>(std::move(map));
+            std::lock_guard<std::mutex> lock(m_writer);
+            m_retired.reserve(m_retired.size() + 1);
+            const map_type* old = m_current.exchange(next.release());
+            m_retired.emplace_back(old, m_epoch.fetch_add(1) + 1);
+            collect();
+        }
+
+        /**
+         * @brief Destroys retired maps no reader can still be using.
+         * 
+         * @return size_type Number of retired maps still alive.
+         */
+        size_type reclaim() {
+            std::lock_guard<std::mutex> lock(m_writer);
+            collect();
+            return m_retired.size();
+        }
+    private:
+        /**
+         * @brief Epoch a reader entered at, or zero if the slot is free.
+         */
+        struct alignas(64) reader_slot {
+            std::atomic<uint64_t> epoch{0};
+        };
+
+        std::atomic<const map_type*> m_current;
+        std::atomic<uint64_t> m_epoch{1};
+        std::unique_ptr<reader_slot[]> m_slots;
+        size_type m_slot_count;
+
+        std::mutex m_writer;
+        std::vector<std::pair<const map_type*, uint64_t>> m_retired;
+
+        static size_type thread_hint() {
+            static thread_local size_type hint =
+                mix64(std::hash<std::thread::id>()(std::this_thread::get_id()));
+            return hint;
+        }
+
+        /**
+         * @brief Destroys retired maps, given the writer lock.
+         * 
+         * A map retired at epoch e was unpublished before the epoch became
+         * e, so a reader that entered at e or later can't have seen it.
+         */
+        void collect() {
+            uint64_t oldest = uint64_t(-1);
+            for (size_type i = 0; i < m_slot_count; i++) {
+                uint64_t epoch = m_slots[i].epoch.load();
+                if (epoch != 0) oldest = std::min(oldest, epoch);
+            }
+
+            auto alive = std::remove_if(m_retired.begin(), m_retired.end(),
+                [&](const auto& retired) {
+                    if (retired.second > oldest) return false;
+                    delete retired.first;
+                    return true;
+                });
+            m_retired.erase(alive, m_retired.end());
+        }
+    };
+};
+
+namespace std {
+    template <typename Tag, typename Value>
+    struct tuple_size<perfhash::map_slot<Tag, Value>>
+        : integral_constant<size_t, 2> {};
+
+    template <typename Tag, typename Value>
+    struct tuple_element<0, perfhash::map_slot<Tag, Value>> {
+        using type = Tag;
+    };
+
+    template <typename Tag, typename Value>
+    struct tuple_element<1, perfhash::map_slot<Tag, Value>> {
+        using type = Value;
+    };
+}